@@ -0,0 +1,26 @@
+#!/bin/sh
+# Pushes a line of N arguments through cash's parser and into an exec, and checks that the
+# command on the other side got every one of them. Exits with 1 if it didn't.
+#
+# usage: bench/args.sh [cash binary]    (N defaults to 100000)
+
+CASH=${1:-./cash}
+N=${N:-100000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# One-letter words keep the line well under ARG_MAX, so it's the count that's tested
+words=$(yes a | head -n "$N" | tr '\n' ' ')
+
+# The command writes how many arguments it got, since cash's own output has the prompt in it
+printf "/bin/sh -c 'echo \$# > %s' sh %s\nexit\n" "$tmp/count" "$words" | "$CASH" > /dev/null
+
+count=$(cat "$tmp/count" 2>/dev/null)
+
+if [ "$count" != "$N" ]; then
+    echo "args: the command got ${count:-no} arguments instead of $N" >&2
+    exit 1
+fi
+
+echo "args: $N arguments went through"
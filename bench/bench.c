@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+#include "lex.h"
+#include "parse.h"
+#include "execute.h"
+#include "prompt.h"
+#include "spawn.h"
+#include "builtins.h"
+#include "jobs.h"
+
+#include "globals.h"
+
+// Benchmark harness for the shell's hot paths. It links every object of the shell but
+// main.o, so the globals main.c defines are defined here instead.
+//
+// usage: cash-bench [-q] [-o results.json] [filter]
+
+char* username = "bench";
+char* hostname = "bench";
+
+const char* colors[] = {"\e[0;31m", "\e[0;32m", "\e[0;33m", "\e[0;34m", "\e[0;35m", "\e[0;36m"};
+const char* color_reset = "\e[0m";
+
+int accent_color = 5;
+
+Arena line_arena;
+int last_exit_status = 0;
+int batch_mode = 1;
+
+void report_bg_processes() {
+    jobs_notify();
+}
+
+void report_startup_latency() {
+}
+
+// How many bytes the pipe throughput benchmark moves per run
+#define BENCH_PIPE_BYTES (256L * 1024 * 1024)
+
+// The stream the pipeline settings are compared on, through three stages
+#define BENCH_STREAM_BYTES (2048L * 1024 * 1024)
+#define BENCH_STREAM_LINE "head -c %ld /dev/zero | /bin/cat | /bin/cat > /dev/null"
+
+// Times one run of a benchmark, leaving its setup out
+typedef long long (*BenchFunc)(void* arg);
+
+typedef struct Benchmark {
+    const char* name;
+    BenchFunc func;
+    void* arg;
+    long iterations;
+    long bytes;         // processed per run, for a throughput, 0 for none
+} Benchmark;
+
+typedef struct BenchResult {
+    const char* name;
+    long iterations;
+    long long min_ns;
+    long long median_ns;
+    long long p99_ns;
+    double mean_ns;
+    double mb_per_s;    // 0 when the benchmark has no throughput
+} BenchResult;
+
+static long long now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// ================================ synthetic lines ================================
+
+static char* repeat(const char* piece, const char* separator, int times) {
+    /*
+     * Returns: A new string of the piece repeated, with the separator between repetitions
+     */
+
+    size_t length = strlen(piece);
+    size_t separator_length = strlen(separator);
+    char* line = malloc((length + separator_length) * times + 1);
+    char* end = line;
+
+    for (int i = 0; i < times; i++) {
+        if (i > 0) {
+            memcpy(end, separator, separator_length);
+            end += separator_length;
+        }
+
+        memcpy(end, piece, length);
+        end += length;
+    }
+
+    *end = '\0';
+
+    return line;
+}
+
+static char* long_argv_line;
+static char* quoted_line;
+static char* pipes_line;
+
+// Pipelines of N processes that exit right away, so only setting them up is measured. The
+// full path keeps true from running as a builtin
+static char* pipeline_2;
+static char* pipeline_8;
+static char* pipeline_32;
+
+static char pipe_line[128];
+
+// The same stream with the kernel's defaults, bigger pipes, pinned stages, and both
+static char stream_line[128];
+static char stream_big_pipes_line[160];
+static char stream_pinned_line[CPU_SETSIZE * 5 + 128];
+static char stream_tuned_line[CPU_SETSIZE * 5 + 128];
+
+static void allowed_cpu_list(char* buffer, size_t size) {
+    /*
+     * Writes the CPUs the harness may run on as a list, like "0,1,2,3"
+     */
+
+    cpu_set_t set;
+    size_t length = 0;
+
+    buffer[0] = '\0';
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        snprintf(buffer, size, "0");
+        return;
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && length < size; cpu++) {
+        if (CPU_ISSET(cpu, &set))
+            length += snprintf(buffer + length, size - length, "%s%d", length > 0 ? "," : "", cpu);
+    }
+}
+
+static void make_lines() {
+    long_argv_line = repeat("argument", " ", 4096);
+    quoted_line = repeat("\"double quoted\" 'single quoted' escaped\\ space mixed\"quo\"'tes'", " ", 512);
+    pipes_line = repeat("command -a --flag value", " | ", 512);
+
+    pipeline_2 = repeat("/bin/true", " | ", 2);
+    pipeline_8 = repeat("/bin/true", " | ", 8);
+    pipeline_32 = repeat("/bin/true", " | ", 32);
+
+    snprintf(pipe_line, sizeof(pipe_line), "head -c %ld /dev/zero | /bin/cat > /dev/null", BENCH_PIPE_BYTES);
+
+    char cpus[CPU_SETSIZE * 5];
+    allowed_cpu_list(cpus, sizeof(cpus));
+
+    snprintf(stream_line, sizeof(stream_line), BENCH_STREAM_LINE, BENCH_STREAM_BYTES);
+    snprintf(stream_big_pipes_line, sizeof(stream_big_pipes_line), "pipeline -s 1M " BENCH_STREAM_LINE, BENCH_STREAM_BYTES);
+    snprintf(stream_pinned_line, sizeof(stream_pinned_line), "pipeline -c %s -S " BENCH_STREAM_LINE, cpus, BENCH_STREAM_BYTES);
+    snprintf(stream_tuned_line, sizeof(stream_tuned_line), "pipeline -s 1M -c %s -S " BENCH_STREAM_LINE, cpus, BENCH_STREAM_BYTES);
+}
+
+// ================================== benchmarks ===================================
+
+static long long bench_lex(void* arg) {
+    char* line = arg;
+    Lexer lexer;
+    Token token;
+
+    long long start = now_ns();
+
+    lexer_init(&lexer, line);
+    while (next_token(&lexer, &token) != TOK_END && token.type != TOK_ERROR)
+        ;
+
+    return now_ns() - start;
+}
+
+static long long bench_parse(void* arg) {
+    long long start = now_ns();
+    parse_input(arg);
+    long long elapsed = now_ns() - start;
+
+    arena_reset(&line_arena);
+
+    return elapsed;
+}
+
+static long long bench_separate(void* arg) {
+    char** input = parse_input(arg);
+
+    long long start = now_ns();
+    separate_inputs(input);
+    long long elapsed = now_ns() - start;
+
+    arena_reset(&line_arena);
+
+    return elapsed;
+}
+
+static long long bench_prompt(void* arg) {
+    int full = *(int*)arg;
+
+    if (full)
+        prompt_invalidate(PROMPT_ALL);
+
+    long long start = now_ns();
+    generate_prompt();
+
+    return now_ns() - start;
+}
+
+static long long bench_spawn(void* arg) {
+    static char* argv[] = { "true", NULL };
+
+    spawn_set_backend(arg);
+
+    SpawnRequest request;
+    spawn_request_init(&request, argv);
+
+    long long start = now_ns();
+
+    pid_t pid = spawn_process(&request);
+    if (pid != -1)
+        waitpid(pid, NULL, 0);
+
+    return now_ns() - start;
+}
+
+static long long bench_line(void* arg) {
+    // execute_line() may write into its line, so each run gets a fresh copy
+    char* line = strdup(arg);
+
+    long long start = now_ns();
+    execute_line(line);
+    long long elapsed = now_ns() - start;
+
+    free(line);
+
+    return elapsed;
+}
+
+// ==================================== harness ====================================
+
+static int compare_ns(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+static BenchResult run_benchmark(const Benchmark* bench) {
+    /*
+     * Runs a benchmark a tenth of its iterations to warm up, then its iterations, timing
+     * each run separately
+     *
+     * Returns: The distribution of the timed runs
+     */
+
+    for (long i = 0; i < bench->iterations / 10; i++)
+        bench->func(bench->arg);
+
+    long long* samples = malloc(sizeof(long long) * bench->iterations);
+    double total = 0;
+
+    for (long i = 0; i < bench->iterations; i++) {
+        samples[i] = bench->func(bench->arg);
+        total += samples[i];
+    }
+
+    qsort(samples, bench->iterations, sizeof(long long), compare_ns);
+
+    BenchResult result = {
+        .name = bench->name,
+        .iterations = bench->iterations,
+        .min_ns = samples[0],
+        .median_ns = samples[bench->iterations / 2],
+        .p99_ns = samples[bench->iterations * 99 / 100],
+        .mean_ns = total / bench->iterations,
+    };
+
+    if (bench->bytes > 0 && result.median_ns > 0)
+        result.mb_per_s = bench->bytes / (result.median_ns / 1e9) / (1024 * 1024);
+
+    free(samples);
+
+    return result;
+}
+
+static void print_result(const BenchResult* result) {
+    printf("%-24s %10ld %12.3f %12.3f %12.3f %12.3f", result->name, result->iterations,
+           result->min_ns / 1e3, result->median_ns / 1e3, result->p99_ns / 1e3, result->mean_ns / 1e3);
+
+    if (result->mb_per_s > 0)
+        printf(" %10.1f", result->mb_per_s);
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static int write_json(const char* path, const BenchResult* results, int count) {
+    /*
+     * Writes the results as a JSON array, one object per benchmark with its times in
+     * nanoseconds, to compare between builds
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    FILE* file = fopen(path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "%serror%s: can't write %s\n", colors[ERR_COLOR], color_reset, path);
+        return 0;
+    }
+
+    fprintf(file, "[\n");
+
+    for (int i = 0; i < count; i++) {
+        const BenchResult* result = &results[i];
+
+        fprintf(file, "  {\"name\": \"%s\", \"iterations\": %ld, \"min_ns\": %lld, \"median_ns\": %lld, "
+                "\"p99_ns\": %lld, \"mean_ns\": %.0f", result->name, result->iterations,
+                result->min_ns, result->median_ns, result->p99_ns, result->mean_ns);
+
+        if (result->mb_per_s > 0)
+            fprintf(file, ", \"mb_per_s\": %.1f", result->mb_per_s);
+
+        fprintf(file, "}%s\n", (i + 1 < count) ? "," : "");
+    }
+
+    fprintf(file, "]\n");
+    fclose(file);
+
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    const char* json_path = NULL;
+    const char* filter = NULL;
+    int quick = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-q") == 0)
+            quick = 1;
+        else if (argv[i][0] != '-')
+            filter = argv[i];
+        else {
+            fprintf(stderr, "usage: cash-bench [-q] [-o results.json] [filter]\n");
+            return 2;
+        }
+    }
+
+    jobs_init();
+    spawn_init();
+    builtins_init();
+
+    make_lines();
+
+    int cached = 0, full = 1;
+
+    const Benchmark benchmarks[] = {
+        { "lex/long-argv",      bench_lex,      long_argv_line, 2000, strlen(long_argv_line) },
+        { "lex/quoted",         bench_lex,      quoted_line,    2000, strlen(quoted_line) },
+        { "lex/pipes",          bench_lex,      pipes_line,     2000, strlen(pipes_line) },
+        { "parse/long-argv",    bench_parse,    long_argv_line, 2000, strlen(long_argv_line) },
+        { "parse/quoted",       bench_parse,    quoted_line,    2000, strlen(quoted_line) },
+        { "parse/pipes",        bench_parse,    pipes_line,     2000, strlen(pipes_line) },
+        { "separate/pipes",     bench_separate, pipes_line,     2000, 0 },
+        { "prompt/cached",      bench_prompt,   &cached,        20000, 0 },
+        { "prompt/full",        bench_prompt,   &full,          20000, 0 },
+        { "spawn/posix_spawn",  bench_spawn,    "posix_spawn",  1000, 0 },
+        { "spawn/vfork",        bench_spawn,    "vfork",        1000, 0 },
+        { "spawn/fork",         bench_spawn,    "fork",         1000, 0 },
+        { "pipeline/2",         bench_line,     pipeline_2,     500, 0 },
+        { "pipeline/8",         bench_line,     pipeline_8,     200, 0 },
+        { "pipeline/32",        bench_line,     pipeline_32,    100, 0 },
+        { "pipe/throughput",    bench_line,     pipe_line,      10, BENCH_PIPE_BYTES },
+        { "stream/default",     bench_line,     stream_line,    3, BENCH_STREAM_BYTES },
+        { "stream/1M-pipes",    bench_line,     stream_big_pipes_line, 3, BENCH_STREAM_BYTES },
+        { "stream/pinned",      bench_line,     stream_pinned_line, 3, BENCH_STREAM_BYTES },
+        { "stream/1M-pinned",   bench_line,     stream_tuned_line, 3, BENCH_STREAM_BYTES },
+    };
+
+    int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    SpawnBackend backend = spawn_backend;
+    BenchResult* results = malloc(sizeof(BenchResult) * count);
+    int ran = 0;
+
+    printf("%-24s %10s %12s %12s %12s %12s %10s\n", "benchmark", "runs", "min (us)", "median (us)",
+           "p99 (us)", "mean (us)", "MB/s");
+
+    for (int i = 0; i < count; i++) {
+        Benchmark bench = benchmarks[i];
+
+        if (filter != NULL && strstr(bench.name, filter) == NULL)
+            continue;
+
+        if (quick)
+            bench.iterations = (bench.iterations + 9) / 10;
+
+        results[ran] = run_benchmark(&bench);
+        spawn_backend = backend;
+        print_result(&results[ran]);
+        ran++;
+    }
+
+    int status = 0;
+
+    if (json_path != NULL && !write_json(json_path, results, ran))
+        status = 1;
+
+    free(results);
+
+    return status;
+}
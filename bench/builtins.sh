@@ -0,0 +1,59 @@
+#!/bin/sh
+# Runs each hot utility N times from a cash script, once through the builtin and once through
+# the external binary that cash used to fork and exec, and compares the wall time.
+#
+# usage: bench/builtins.sh [cash binary]    (N defaults to 10000)
+
+CASH=${1:-./cash}
+N=${N:-10000}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+external() {
+    for dir in /bin /usr/bin; do
+        if [ -x "$dir/$1" ]; then
+            echo "$dir/$1"
+            return
+        fi
+    done
+}
+
+run() {
+    # $1: command to repeat
+    i=0
+    : > "$tmp/script"
+    while [ $i -lt "$N" ]; do
+        echo "$1" >> "$tmp/script"
+        i=$((i + 1))
+    done
+
+    start=$(now_ms)
+    "$CASH" "$tmp/script" > /dev/null
+    end=$(now_ms)
+
+    echo $((end - start))
+}
+
+echo "hello" > "$tmp/file"
+
+printf "%-28s %12s %12s %9s\n" "command (x$N)" "exec (ms)" "builtin (ms)" "speedup"
+
+for cmd in "echo hello" "true" "false" "test -f $tmp/file" "printf %s\\\\n hello" "cat $tmp/file"; do
+    name=${cmd%% *}
+    path=$(external "$name")
+
+    if [ -z "$path" ]; then
+        continue
+    fi
+
+    exec_ms=$(run "$path${cmd#$name}")
+    builtin_ms=$(run "$cmd")
+
+    printf "%-28s %12d %12d %8.1fx\n" "$name" "$exec_ms" "$builtin_ms" \
+        "$(echo "$exec_ms $builtin_ms" | awk '{ printf "%.1f", $1 / ($2 > 0 ? $2 : 1) }')"
+done
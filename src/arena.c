@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+#include "globals.h"
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+static ArenaBlock* new_block(size_t size) {
+    /*
+     * Allocates a new arena block with room for at least the given number of bytes
+     */
+
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+
+    if (block == NULL) {
+        fprintf(stderr, "%serror%s: out of memory\n", colors[ERR_COLOR], color_reset);
+        exit(EXIT_FAILURE);
+    }
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    return block;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    /*
+     * Bump allocates memory from an arena. The memory stays valid until the arena is reset
+     *
+     * Arguments:
+     *  arena: The arena to allocate from
+     *  size: The number of bytes to allocate
+     *
+     * Returns: A pointer to the allocated memory, aligned for any type
+     */
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (arena->head == NULL) {
+        arena->head = new_block(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        arena->current = arena->head;
+    }
+
+    ArenaBlock* block = arena->current;
+
+    // Move on to the next retained block, or chain in a new one if it's too small
+    while (block->size - block->used < size) {
+        if (block->next == NULL || block->next->size < size) {
+            ArenaBlock* fresh = new_block(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+
+        block = block->next;
+        block->used = 0;
+    }
+
+    arena->current = block;
+
+    void* ptr = block->data + block->used;
+    block->used += size;
+
+    return ptr;
+}
+
+char* arena_strdup(Arena* arena, const char* str) {
+    /*
+     * Copies a string into an arena
+     */
+
+    return arena_strndup(arena, str, strlen(str));
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t len) {
+    /*
+     * Copies the first len characters of a string into an arena, and null terminates the copy
+     */
+
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+    /*
+     * Returns: A mark of everything allocated from an arena so far
+     */
+
+    ArenaMark mark = { arena->current, arena->current != NULL ? arena->current->used : 0 };
+
+    return mark;
+}
+
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    /*
+     * Frees everything allocated from an arena since the mark was taken, keeping what came
+     * before it. Like arena_reset(), the blocks after the mark are cleared lazily
+     */
+
+    if (mark.block == NULL) {
+        arena_reset(arena);
+        return;
+    }
+
+    arena->current = mark.block;
+    mark.block->used = mark.used;
+}
+
+void arena_reset(Arena* arena) {
+    /*
+     * Frees everything allocated from an arena at once. The blocks are kept around for reuse,
+     * each one gets cleared lazily when the allocator reaches it again
+     */
+
+    if (arena->head == NULL)
+        return;
+
+    arena->current = arena->head;
+    arena->head->used = 0;
+}
+
+void arena_release(Arena* arena) {
+    /*
+     * Returns all of an arena's blocks to the system
+     */
+
+    ArenaBlock* block = arena->head;
+
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->head = NULL;
+    arena->current = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 16384
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* head;
+    ArenaBlock* current;
+} Arena;
+
+// How far an arena was filled, to go back to with arena_rewind()
+typedef struct ArenaMark {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strdup(Arena* arena, const char* str);
+char* arena_strndup(Arena* arena, const char* str, size_t len);
+
+ArenaMark arena_mark(Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+
+void arena_reset(Arena* arena);
+void arena_release(Arena* arena);
+
+#endif
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argvec.h"
+#include "arena.h"
+
+void argvec_init(ArgVector* vec, Arena* arena) {
+    /*
+     * Prepares an empty argument vector backed by the given arena
+     */
+
+    vec->arena = arena;
+    vec->length = 0;
+    vec->capacity = ARGVEC_INITIAL_CAPACITY;
+    vec->items = arena_alloc(arena, sizeof(char*) * vec->capacity);
+}
+
+void argvec_push(ArgVector* vec, char* word) {
+    /*
+     * Appends a word to an argument vector, doubling its capacity when it's full.
+     * A slot is always kept free for the NULL terminator
+     */
+
+    if (vec->length + 1 >= vec->capacity) {
+        // The old array stays in the arena until it's reset, which costs at most as much as the final array
+        char** items = arena_alloc(vec->arena, sizeof(char*) * vec->capacity * 2);
+        memcpy(items, vec->items, sizeof(char*) * vec->length);
+
+        vec->items = items;
+        vec->capacity *= 2;
+    }
+
+    vec->items[vec->length] = word;
+    vec->length++;
+}
+
+char** argvec_finish(ArgVector* vec) {
+    /*
+     * Returns: The NULL terminated array of words
+     */
+
+    vec->items[vec->length] = NULL;
+
+    return vec->items;
+}
+
+size_t argv_size(char** argv) {
+    /*
+     * Computes how much of the kernel's ARG_MAX space an argument vector takes up,
+     * counting each string with its terminator and each pointer
+     */
+
+    size_t size = 0;
+
+    for (int i = 0; argv[i] != NULL; i++)
+        size += strlen(argv[i]) + 1 + sizeof(char*);
+
+    return size + sizeof(char*);
+}
@@ -0,0 +1,24 @@
+#ifndef ARGVEC_H
+#define ARGVEC_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+#define ARGVEC_INITIAL_CAPACITY 16
+
+// A growable, NULL terminated argument vector allocated from an arena
+typedef struct ArgVector {
+    char** items;
+    size_t length;
+    size_t capacity;
+    Arena* arena;
+} ArgVector;
+
+void argvec_init(ArgVector* vec, Arena* arena);
+void argvec_push(ArgVector* vec, char* word);
+char** argvec_finish(ArgVector* vec);
+
+size_t argv_size(char** argv);
+
+#endif
@@ -0,0 +1,309 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "batch.h"
+#include "brace.h"
+#include "glob.h"
+#include "argvec.h"
+#include "execute.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "builtins.h"
+
+#include "globals.h"
+
+extern char** environ;
+
+int arg_source_split(int argc, char** argv, char*** words) {
+    /*
+     * Splits a builtin's arguments at ":::" into the command and the words it's run with
+     *
+     * Arguments:
+     *  argv: Cut off at the ":::"
+     *  words: Gets the words after it, or NULL if there's no ":::"
+     *
+     * Returns: The number of arguments before the ":::"
+     */
+
+    *words = NULL;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], ":::") == 0) {
+            argv[i] = NULL;
+            *words = &argv[i + 1];
+            return i;
+        }
+    }
+
+    return argc;
+}
+
+int arg_source_init(ArgSource* source, char** words) {
+    /*
+     * Prepares to read arguments from a list of words, or from standard input
+     *
+     * Arguments:
+     *  words: A NULL terminated list of words, or NULL to read lines from standard input
+     *
+     * Returns: 1 on success, 0 if standard input can't be read
+     */
+
+    memset(source, 0, sizeof(ArgSource));
+    source->words = words;
+
+    if (words == NULL) {
+        // Our own copy, so nothing read ahead is left in the shell's stdin buffer
+        int fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+
+        if (fd == -1 || (source->input = fdopen(fd, "r")) == NULL) {
+            if (fd != -1)
+                close(fd);
+
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+char* arg_source_next(ArgSource* source) {
+    /*
+     * Returns: The next argument, valid until the next call, or NULL when there are no more
+     */
+
+    if (source->input != NULL) {
+        ssize_t length = getline(&source->line, &source->line_size, source->input);
+
+        if (length == -1)
+            return NULL;
+
+        if (length > 0 && source->line[length - 1] == '\n')
+            source->line[length - 1] = '\0';
+
+        return source->line;
+    }
+
+    while (1) {
+        if (source->brace != NULL) {
+            char* word = brace_next(source->brace);
+
+            if (word != NULL) {
+                glob_unescape(word);
+                return word;
+            }
+
+            source->brace = NULL;
+        }
+
+        if (source->words == NULL || *source->words == NULL)
+            return NULL;
+
+        char* word = *source->words++;
+
+        // Deferred brace words are generated one word at a time
+        if ((source->brace = brace_lookup(word)) == NULL)
+            return word;
+    }
+}
+
+void arg_source_close(ArgSource* source) {
+    if (source->input != NULL)
+        fclose(source->input);
+
+    free(source->line);
+}
+
+static int run_command(char** argv) {
+    /*
+     * Runs one batch of a command to completion, with the shell's stdin, stdout and stderr
+     *
+     * Returns: The command's exit status
+     */
+
+    Builtin* builtin = find_builtin(argv[0]);
+
+    if (builtin != NULL) {
+        int argc = 0;
+        while (argv[argc] != NULL)
+            argc++;
+
+        int status = builtin->func(argc, argv);
+        fflush(stdout);
+
+        return status;
+    }
+
+    SpawnRequest request;
+    spawn_request_init(&request, argv);
+
+    request.path = path_lookup(argv[0]);
+
+    if (request.path == NULL) {
+        report_command_not_found(argv[0]);
+        return 127;
+    }
+
+    pid_t pid = spawn_process(&request);
+
+    if (pid == -1) {
+        report_spawn_error(argv[0]);
+        return last_exit_status;
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+
+    return exit_status(status);
+}
+
+static void print_batch_usage() {
+    fprintf(stderr, "usage: batch [-n count] command [args] [::: words]\n\n");
+    fprintf(stderr, "  Runs the command with as many of the words appended as fit in one exec, again and\n");
+    fprintf(stderr, "  again until they're used up. Without ':::' the words are the lines of stdin\n\n");
+    fprintf(stderr, "  -n count   append at most this many words each time\n");
+}
+
+static int read_max_words(const char* arg, int* max_words) {
+    char* end;
+    long value = strtol(arg, &end, 10);
+
+    if (*end != '\0' || end == arg || value < 1 || value > INT_MAX)
+        return 0;
+
+    *max_words = value;
+
+    return 1;
+}
+
+int builtin_batch(int argc, char** argv) {
+    int max_words = 0;
+    int first = 1;
+
+    for (; first < argc; first++) {
+        if (strcmp(argv[first], "-h") == 0) {
+            print_batch_usage();
+            return 0;
+        }
+        else if (strcmp(argv[first], "-n") == 0 && first + 1 < argc) {
+            if (!read_max_words(argv[++first], &max_words)) {
+                fprintf(stderr, "%serror%s: batch: not a number of words: %s\n", colors[ERR_COLOR], color_reset, argv[first]);
+                return 2;
+            }
+        }
+        else
+            break;
+    }
+
+    char** words;
+    int command_argc = arg_source_split(argc - first, argv + first, &words);
+
+    if (command_argc == 0) {
+        print_batch_usage();
+        return 2;
+    }
+
+    char** command = argv + first;
+
+    // What every batch has to fit in, besides the words
+    long limit = get_arg_max() - BATCH_HEADROOM - (long)argv_size(environ);
+    long base = argv_size(command);
+    long word_max = get_arg_strlen_max();
+
+    if (base >= limit) {
+        fprintf(stderr, "%serror%s: batch: the command alone doesn't fit in ARG_MAX\n", colors[ERR_COLOR], color_reset);
+        return 1;
+    }
+
+    ArgSource source;
+    if (!arg_source_init(&source, words)) {
+        fprintf(stderr, "%serror%s: batch: can't read stdin\n", colors[ERR_COLOR], color_reset);
+        return 1;
+    }
+
+    // One exec's worth of words, reused for every batch, so memory doesn't grow with their number
+    size_t room = limit - base;
+    size_t capacity = command_argc + room / (sizeof(char*) + 1) + 1;
+
+    char* pool = malloc(room);
+    char** batch_argv = malloc(sizeof(char*) * capacity);
+
+    if (pool == NULL || batch_argv == NULL) {
+        fprintf(stderr, "%serror%s: out of memory\n", colors[ERR_COLOR], color_reset);
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(batch_argv, command, sizeof(char*) * command_argc);
+
+    // The ARG_MAX space taken by the words so far, and the pool space taken by their strings
+    size_t used = 0;
+    size_t packed = 0;
+    int count = 0;
+    int failed = 0;
+    int status = 0;
+    char* word;
+
+    while ((word = arg_source_next(&source)) != NULL) {
+        size_t length = strlen(word);
+        size_t cost = length + 1 + sizeof(char*);
+
+        if ((long)length >= word_max) {
+            fprintf(stderr, "%serror%s: batch: skipping a word of %zu bytes, the limit is %ld\n",
+                    colors[ERR_COLOR], color_reset, length, word_max);
+            failed = 1;
+            continue;
+        }
+
+        // Too big to go with the command even on its own, and for the pool
+        if (cost > room) {
+            fprintf(stderr, "%serror%s: batch: skipping a word of %zu bytes, only %zu fit next to the command\n",
+                    colors[ERR_COLOR], color_reset, length, room);
+            failed = 1;
+            continue;
+        }
+
+        if (count > 0 && (used + cost > room || count == max_words)) {
+            batch_argv[command_argc + count] = NULL;
+            status = run_command(batch_argv);
+
+            // Like xargs, a command that can't be run at all stops everything
+            if (status == 127 || status == 126)
+                break;
+            if (status != 0)
+                failed = 1;
+
+            used = 0;
+            packed = 0;
+            count = 0;
+        }
+
+        batch_argv[command_argc + count] = memcpy(pool + packed, word, length + 1);
+        count++;
+        packed += length + 1;
+        used += cost;
+    }
+
+    if (count > 0 && status != 127 && status != 126) {
+        batch_argv[command_argc + count] = NULL;
+        status = run_command(batch_argv);
+
+        if (status != 0)
+            failed = 1;
+    }
+
+    arg_source_close(&source);
+    free(pool);
+    free(batch_argv);
+
+    if (status == 127 || status == 126)
+        return status;
+
+    return failed ? 123 : 0;
+}
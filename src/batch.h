@@ -0,0 +1,29 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#include "brace.h"
+
+// Room left in ARG_MAX for what the kernel and the dynamic loader put next to the arguments
+#define BATCH_HEADROOM 2048
+
+// Where the arguments of batch and parallel come from: the words after ":::", generating
+// deferred brace words as it goes, or the lines of standard input
+typedef struct ArgSource {
+    char** words;
+    Brace* brace;
+
+    FILE* input;
+    char* line;
+    size_t line_size;
+} ArgSource;
+
+int arg_source_init(ArgSource* source, char** words);
+char* arg_source_next(ArgSource* source);
+void arg_source_close(ArgSource* source);
+int arg_source_split(int argc, char** argv, char*** words);
+
+int builtin_batch(int argc, char** argv);
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "benchmark.h"
+#include "execute.h"
+#include "parse.h"
+#include "lex.h"
+#include "usage.h"
+
+#include "globals.h"
+
+// A command line prepared once and run again and again. Running it writes into its words
+// (redirections are cut off with a NULL), so each run works on a fresh copy
+typedef struct BenchCommand {
+    char** words;       // the words with every pipe replaced by a NULL, as separate_inputs() leaves them
+    int words_num;
+    char*** stages;     // slices of words, NULL if the line isn't a pipeline
+    int stages_num;
+
+    char** run_words;
+    char*** run_stages;
+
+    ArenaMark mark;     // line_arena past the words, what each run's allocations are freed back to
+} BenchCommand;
+
+static double ms(long long ns) {
+    return ns / 1e6;
+}
+
+static int compare_ns(const void* a, const void* b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+static long long value_at(const long long* sorted, int runs, double percentile, int* count) {
+    /*
+     * Returns: The smallest sample that percentile percent of the samples are at or below,
+     *          with how many samples that is in count
+     */
+
+    int index = (int)ceil(percentile / 100 * runs) - 1;
+
+    if (index < 0)
+        index = 0;
+    if (index >= runs)
+        index = runs - 1;
+
+    if (count != NULL)
+        *count = index + 1;
+
+    return sorted[index];
+}
+
+static void bench_command_init(BenchCommand* command, char** input) {
+    command->words_num = 0;
+    while (input[command->words_num] != NULL)
+        command->words_num++;
+
+    command->stages = separate_inputs(input);
+    command->stages_num = 0;
+
+    if (command->stages != NULL) {
+        while (command->stages[command->stages_num] != NULL)
+            command->stages_num++;
+
+        // The stages are slices of a single copy of the words
+        command->words = command->stages[0];
+    }
+    else
+        command->words = input;
+
+    command->run_words = malloc(sizeof(char*) * (command->words_num + 1));
+    command->run_stages = malloc(sizeof(char**) * (command->stages_num + 1));
+
+    command->mark = arena_mark(&line_arena);
+}
+
+static void bench_command_free(BenchCommand* command) {
+    free(command->run_words);
+    free(command->run_stages);
+}
+
+static long long bench_command_run(BenchCommand* command, double* user, double* sys) {
+    /*
+     * Runs the command line once, the way execute_line() would. What the previous run
+     * allocated from line_arena is freed first, so the words are all that's kept across runs
+     *
+     * Arguments:
+     *  user, sys: Set to the CPU time every stage of the line used
+     *
+     * Returns: The wall time of the run in nanoseconds
+     */
+
+    arena_rewind(&line_arena, command->mark);
+
+    memcpy(command->run_words, command->words, sizeof(char*) * (command->words_num + 1));
+
+    for (int i = 0; i < command->stages_num; i++)
+        command->run_stages[i] = command->run_words + (command->stages[i] - command->words);
+    command->run_stages[command->stages_num] = NULL;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (command->stages != NULL)
+        execute_piped_inputs(command->run_stages);
+    else
+        execute_input(command->run_words);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *user = 0;
+    *sys = 0;
+
+    for (int i = 0; i < line_usage.stages_num; i++) {
+        if (line_usage.stages[i].status != -1) {
+            *user += usage_seconds(&line_usage.stages[i].usage.ru_utime);
+            *sys += usage_seconds(&line_usage.stages[i].usage.ru_stime);
+        }
+    }
+
+    return (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+}
+
+static int write_histogram(const char* path, const long long* sorted, int runs, double mean, double stddev) {
+    /*
+     * Writes the distribution of the run times in HdrHistogram's percentile format, in
+     * milliseconds, which its plotter and other tools that read .hgrm files accept. The
+     * percentiles get denser towards the tail, a fixed number per halving of the distance
+     * to 100%
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    FILE* file = fopen(path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "%serror%s: bench: can't write %s\n", colors[ERR_COLOR], color_reset, path);
+        return 0;
+    }
+
+    fprintf(file, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+    for (int half = 0; half < 30; half++) {
+        double from = 100 - 100.0 / (1 << half);
+        double step = 100.0 / (1 << (half + 1)) / BENCHMARK_TICKS_PER_HALF;
+
+        for (int tick = 0; tick < BENCHMARK_TICKS_PER_HALF; tick++) {
+            double percentile = from + tick * step;
+            int count;
+            long long value = value_at(sorted, runs, percentile, &count);
+
+            fprintf(file, "%12.3f %14.12f %10d %14.2f\n", ms(value), percentile / 100, count, 100 / (100 - percentile));
+        }
+
+        // Past the point where a single run is more than the percentiles resolve
+        if ((1 << (half + 1)) >= runs)
+            break;
+    }
+
+    fprintf(file, "%12.3f %14.12f %10d\n", ms(sorted[runs - 1]), 1.0, runs);
+    fprintf(file, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean, stddev);
+    fprintf(file, "#[Max     = %12.3f, Total count    = %12d]\n", ms(sorted[runs - 1]), runs);
+
+    fclose(file);
+
+    return 1;
+}
+
+static void print_bench_usage() {
+    fprintf(stderr, "usage: bench [-n runs] [-w warmup] [-o histogram] command [| command ...]\n\n");
+    fprintf(stderr, "  Runs a command line a number of times and reports its wall time (min, median,\n");
+    fprintf(stderr, "  p95, p99, max, mean) and the user and system CPU time of a run\n\n");
+    fprintf(stderr, "  -n runs       how many runs to time (default: %d)\n", BENCHMARK_DEFAULT_RUNS);
+    fprintf(stderr, "  -w warmup     how many runs to do first without timing them (default: %d)\n", BENCHMARK_DEFAULT_WARMUP);
+    fprintf(stderr, "  -o histogram  write the distribution to a file, in HdrHistogram's .hgrm format\n");
+}
+
+static int read_count(const char* arg, int minimum, int* count) {
+    char* end;
+    long value = strtol(arg, &end, 10);
+
+    if (*end != '\0' || end == arg || value < minimum || value > 100000000)
+        return 0;
+
+    *count = value;
+
+    return 1;
+}
+
+static int stops_bench(int status) {
+    // A command that can't run, or that was interrupted, won't do better on the next run
+    return status == 126 || status == 127 || status == 130;
+}
+
+int benchmark_line(char** input) {
+    /*
+     * Runs the command line after a leading "bench" and its options repeatedly, through the
+     * same code that runs any other line, and prints statistics of its run times to stderr
+     *
+     * Arguments:
+     *  input: The parsed line, starting with "bench"
+     *
+     * Returns: 0 if every run succeeded, the status of a run that stopped the benchmark, or 1
+     */
+
+    int runs = BENCHMARK_DEFAULT_RUNS;
+    int warmup = BENCHMARK_DEFAULT_WARMUP;
+    char* histogram = NULL;
+
+    int first = 1;
+
+    for (; input[first] != NULL && input[first][0] == '-'; first++) {
+        char* option = input[first];
+
+        if (strcmp(option, "-h") == 0) {
+            print_bench_usage();
+            return 0;
+        }
+
+        if (input[first + 1] == NULL) {
+            print_bench_usage();
+            return 2;
+        }
+
+        char* value = input[++first];
+
+        if (strcmp(option, "-n") == 0 && read_count(value, 1, &runs))
+            continue;
+        if (strcmp(option, "-w") == 0 && read_count(value, 0, &warmup))
+            continue;
+        if (strcmp(option, "-o") == 0) {
+            histogram = value;
+            continue;
+        }
+
+        print_bench_usage();
+        return 2;
+    }
+
+    char** command_words = input + first;
+
+    if (command_words[0] == NULL || is_operator(command_words[0], TOK_PIPE)) {
+        print_bench_usage();
+        return 2;
+    }
+
+    for (int i = 0; command_words[i] != NULL; i++) {
+        if (is_operator(command_words[i], TOK_AMP)) {
+            fprintf(stderr, "%serror%s: bench: can't time a background job\n", colors[ERR_COLOR], color_reset);
+            return 2;
+        }
+    }
+
+    BenchCommand command;
+    bench_command_init(&command, command_words);
+
+    // Stages are reaped in order, which is cheaper than watching them exit
+    line_usage.precise = 0;
+
+    long long* samples = malloc(sizeof(long long) * runs);
+    double user = 0, sys = 0;
+    int failed = 0;
+    int status = 0;
+
+    for (int i = 0; i < warmup + runs; i++) {
+        double run_user, run_sys;
+        long long ns = bench_command_run(&command, &run_user, &run_sys);
+
+        if (last_exit_status != 0) {
+            failed++;
+            status = last_exit_status;
+
+            if (stops_bench(status)) {
+                fprintf(stderr, "%serror%s: bench: stopped, a run exited with %d\n", colors[ERR_COLOR], color_reset, status);
+                bench_command_free(&command);
+                free(samples);
+                return status;
+            }
+        }
+
+        if (i < warmup)
+            continue;
+
+        samples[i - warmup] = ns;
+        user += run_user;
+        sys += run_sys;
+    }
+
+    bench_command_free(&command);
+
+    double mean = 0;
+    for (int i = 0; i < runs; i++)
+        mean += ms(samples[i]);
+    mean /= runs;
+
+    double variance = 0;
+    for (int i = 0; i < runs; i++)
+        variance += (ms(samples[i]) - mean) * (ms(samples[i]) - mean);
+    double stddev = (runs > 1) ? sqrt(variance / (runs - 1)) : 0;
+
+    qsort(samples, runs, sizeof(long long), compare_ns);
+
+    // Builtins and the like are shown in microseconds, anything slower in milliseconds
+    long long median = value_at(samples, runs, 50, NULL);
+    const char* unit = (median < 1000000) ? "us" : "ms";
+    double scale = (median < 1000000) ? 1e3 : 1;
+
+    fprintf(stderr, "%d runs, %d warmup\n", runs, warmup);
+    fprintf(stderr, "%10s %10s %10s %10s %10s %10s %10s\n", "min", "median", "p95", "p99", "max", "mean", "stddev");
+    fprintf(stderr, "%8.3f%s %8.3f%s %8.3f%s %8.3f%s %8.3f%s %8.3f%s %8.3f%s\n",
+            ms(samples[0]) * scale, unit, ms(median) * scale, unit,
+            ms(value_at(samples, runs, 95, NULL)) * scale, unit, ms(value_at(samples, runs, 99, NULL)) * scale, unit,
+            ms(samples[runs - 1]) * scale, unit, mean * scale, unit, stddev * scale, unit);
+    fprintf(stderr, "user %.3f%s, sys %.3f%s per run\n", user * 1e3 / runs * scale, unit, sys * 1e3 / runs * scale, unit);
+
+    if (histogram != NULL && !write_histogram(histogram, samples, runs, mean, stddev))
+        status = 1;
+
+    free(samples);
+
+    if (failed > 0) {
+        fprintf(stderr, "%serror%s: bench: %d of %d runs failed\n", colors[ERR_COLOR], color_reset, failed, warmup + runs);
+        return status != 0 ? status : 1;
+    }
+
+    return status;
+}
+
+int builtin_bench(int argc, char** argv) {
+    // Only reached when "bench" isn't the first word of the line, where execute_line() handles it
+    print_bench_usage();
+
+    return 2;
+}
@@ -0,0 +1,13 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#define BENCHMARK_DEFAULT_RUNS 10
+#define BENCHMARK_DEFAULT_WARMUP 1
+
+// Percentile ticks per halving of the distance to 100%, like HdrHistogram's output
+#define BENCHMARK_TICKS_PER_HALF 5
+
+int benchmark_line(char** input);
+int builtin_bench(int argc, char** argv);
+
+#endif
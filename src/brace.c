@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "brace.h"
+#include "arena.h"
+
+// The longest a number in a sequence can get, with its sign
+#define BRACE_NUMBER_LENGTH 21
+
+// Brace words whose words are generated on demand, in line_arena
+static Brace* deferred = NULL;
+
+void brace_begin_line() {
+    /*
+     * Forgets the deferred brace words of the previous command line
+     */
+
+    deferred = NULL;
+}
+
+static const char* find_close(const char* open, const char* end) {
+    /*
+     * Finds the brace that closes an opening one, skipping nested pairs and escapes
+     *
+     * Returns: A pointer to the closing brace, or NULL if it isn't closed before end
+     */
+
+    int depth = 0;
+
+    for (const char* p = open; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == '{')
+            depth++;
+        else if (*p == '}' && --depth == 0)
+            return p;
+    }
+
+    return NULL;
+}
+
+static int parse_endpoint(const char* start, const char* end, long* value, int* width, int* is_char) {
+    /*
+     * Parses one end of a sequence, either an integer or a single character
+     *
+     * Returns: 1 if it's valid, 0 otherwise
+     */
+
+    size_t length = end - start;
+
+    if (length == 1 && !isdigit((unsigned char)*start)) {
+        *value = (unsigned char)*start;
+        *width = 0;
+        *is_char = 1;
+        return 1;
+    }
+
+    const char* digits = (length > 0 && *start == '-') ? start + 1 : start;
+
+    if (digits == end || length > BRACE_NUMBER_LENGTH - 1)
+        return 0;
+
+    for (const char* p = digits; p < end; p++) {
+        if (!isdigit((unsigned char)*p))
+            return 0;
+    }
+
+    char number[BRACE_NUMBER_LENGTH];
+    memcpy(number, start, length);
+    number[length] = '\0';
+
+    errno = 0;
+    *value = strtol(number, NULL, 10);
+    if (errno == ERANGE)
+        return 0;
+
+    // A leading zero asks for every number to be padded to the same width
+    *width = (*digits == '0' && end - digits > 1) ? length : 0;
+    *is_char = 0;
+
+    return 1;
+}
+
+static BraceNode* parse_range(const char* start, const char* end, Arena* arena) {
+    /*
+     * Parses the inside of a sequence expression, like 1..10, 10..1..2, 001..100 or a..z
+     *
+     * Returns: The node, or NULL if it isn't a sequence
+     */
+
+    const char* dots = NULL;
+    const char* second_dots = NULL;
+
+    for (const char* p = start; p + 1 < end; p++) {
+        if (p[0] == '.' && p[1] == '.') {
+            if (dots == NULL)
+                dots = p;
+            else if (second_dots == NULL && p > dots + 1)
+                second_dots = p;
+            else
+                return NULL;
+
+            p++;
+        }
+    }
+
+    if (dots == NULL)
+        return NULL;
+
+    const char* end_stop = second_dots != NULL ? second_dots : end;
+
+    long from, to, step = 1;
+    int from_width, to_width, step_width;
+    int from_char, to_char, step_char = 0;
+
+    if (!parse_endpoint(start, dots, &from, &from_width, &from_char) ||
+        !parse_endpoint(dots + 2, end_stop, &to, &to_width, &to_char) ||
+        from_char != to_char)
+        return NULL;
+
+    if (second_dots != NULL &&
+        (!parse_endpoint(second_dots + 2, end, &step, &step_width, &step_char) || step_char))
+        return NULL;
+
+    BraceNode* node = arena_alloc(arena, sizeof(BraceNode));
+    memset(node, 0, sizeof(BraceNode));
+
+    node->type = BRACE_RANGE;
+    node->start = from;
+    node->end = to;
+    node->value = from;
+    node->is_char = from_char;
+    node->width = from_width > to_width ? from_width : to_width;
+
+    // The direction always comes from the endpoints
+    node->step = labs(step) == 0 ? 1 : labs(step);
+    if (to < from)
+        node->step = -node->step;
+
+    return node;
+}
+
+static BraceNode* parse_sequence(const char* start, const char* end, Arena* arena, int* found);
+
+static BraceNode* parse_list(const char* start, const char* end, Arena* arena, int* found) {
+    /*
+     * Parses the inside of a brace list, splitting it on the commas that aren't nested
+     *
+     * Returns: The node, or NULL if there are no commas and it isn't a list
+     */
+
+    int commas = 0;
+    int depth = 0;
+
+    for (const char* p = start; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == '{')
+            depth++;
+        else if (*p == '}')
+            depth--;
+        else if (*p == ',' && depth == 0)
+            commas++;
+    }
+
+    if (commas == 0)
+        return NULL;
+
+    BraceNode* node = arena_alloc(arena, sizeof(BraceNode));
+    memset(node, 0, sizeof(BraceNode));
+
+    node->type = BRACE_LIST;
+    node->alternatives = arena_alloc(arena, sizeof(BraceNode*) * (commas + 1));
+
+    const char* piece = start;
+    depth = 0;
+
+    for (const char* p = start; p <= end; p++) {
+        if (p < end && *p == '\\' && p + 1 < end)
+            p++;
+        else if (p < end && *p == '{')
+            depth++;
+        else if (p < end && *p == '}')
+            depth--;
+        else if (p == end || (*p == ',' && depth == 0)) {
+            node->alternatives[node->alternatives_num++] = parse_sequence(piece, p, arena, found);
+            piece = p + 1;
+        }
+    }
+
+    return node;
+}
+
+static BraceNode* parse_sequence(const char* start, const char* end, Arena* arena, int* found) {
+    /*
+     * Parses a run of text and brace expressions into a chain of nodes. A brace that doesn't
+     * start a valid list or sequence is kept as text, like in other shells
+     *
+     * Arguments:
+     *  found: Set to 1 if any list or sequence was found
+     *
+     * Returns: The first node, or NULL for an empty run
+     */
+
+    BraceNode* head = NULL;
+    BraceNode** tail = &head;
+    const char* text = start;
+
+    for (const char* p = start; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+            continue;
+        }
+
+        const char* close;
+        if (*p != '{' || (close = find_close(p, end)) == NULL)
+            continue;
+
+        BraceNode* node = parse_list(p + 1, close, arena, found);
+        if (node == NULL)
+            node = parse_range(p + 1, close, arena);
+        if (node == NULL)
+            continue;
+
+        *found = 1;
+
+        if (p > text) {
+            BraceNode* literal = arena_alloc(arena, sizeof(BraceNode));
+            memset(literal, 0, sizeof(BraceNode));
+
+            literal->type = BRACE_TEXT;
+            literal->text = text;
+            literal->length = p - text;
+
+            *tail = literal;
+            tail = &literal->next;
+        }
+
+        *tail = node;
+        tail = &node->next;
+
+        text = close + 1;
+        p = close;
+    }
+
+    if (end > text) {
+        BraceNode* literal = arena_alloc(arena, sizeof(BraceNode));
+        memset(literal, 0, sizeof(BraceNode));
+
+        literal->type = BRACE_TEXT;
+        literal->text = text;
+        literal->length = end - text;
+
+        *tail = literal;
+    }
+
+    return head;
+}
+
+static size_t sequence_max_length(BraceNode* node) {
+    /*
+     * Returns: The length of the longest word a chain of nodes can produce
+     */
+
+    size_t length = 0;
+
+    for (; node != NULL; node = node->next) {
+        if (node->type == BRACE_TEXT)
+            length += node->length;
+        else if (node->type == BRACE_RANGE)
+            length += node->width > BRACE_NUMBER_LENGTH ? node->width : BRACE_NUMBER_LENGTH;
+        else {
+            size_t longest = 0;
+
+            for (int i = 0; i < node->alternatives_num; i++) {
+                size_t alternative = sequence_max_length(node->alternatives[i]);
+                if (alternative > longest)
+                    longest = alternative;
+            }
+
+            length += longest;
+        }
+    }
+
+    return length;
+}
+
+Brace* brace_parse(const char* pattern, Arena* arena) {
+    /*
+     * Parses a word for brace lists and sequences, which expand to one word for every
+     * combination, in order: a{b,c}{1..2} is ab1 ab2 ac1 ac2. Escaped braces and commas
+     * are left alone
+     *
+     * Arguments:
+     *  pattern: The word, with quoted characters escaped by a backslash
+     *  arena: Where the generator is allocated, the pattern must outlive it
+     *
+     * Returns: A generator for its words, or NULL if it has nothing to expand
+     */
+
+    int found = 0;
+    BraceNode* head = parse_sequence(pattern, pattern + strlen(pattern), arena, &found);
+
+    if (!found)
+        return NULL;
+
+    Brace* brace = arena_alloc(arena, sizeof(Brace));
+    memset(brace, 0, sizeof(Brace));
+
+    brace->head = head;
+    brace->pattern = pattern;
+    brace->max_length = sequence_max_length(head);
+    brace->word = arena_alloc(arena, brace->max_length + 1);
+
+    return brace;
+}
+
+static int advance_node(BraceNode* node);
+
+static int advance_sequence(BraceNode* node) {
+    /*
+     * Steps a chain of nodes to its next combination, turning the last node first
+     *
+     * Returns: 1 if every node wrapped around to its start, 0 otherwise
+     */
+
+    if (node == NULL)
+        return 1;
+
+    if (!advance_sequence(node->next))
+        return 0;
+
+    return advance_node(node);
+}
+
+static int advance_node(BraceNode* node) {
+    /*
+     * Steps a single node to its next value
+     *
+     * Returns: 1 if it wrapped around to its first value, 0 otherwise
+     */
+
+    switch (node->type) {
+        case BRACE_TEXT:
+            return 1;
+
+        case BRACE_LIST:
+            if (!advance_sequence(node->alternatives[node->current]))
+                return 0;
+
+            if (++node->current < node->alternatives_num)
+                return 0;
+
+            node->current = 0;
+            return 1;
+
+        case BRACE_RANGE:
+            // Checked against the distance left so it can't overflow
+            if ((node->step > 0 && node->end - node->value >= node->step) ||
+                (node->step < 0 && node->end - node->value <= node->step)) {
+                node->value += node->step;
+                return 0;
+            }
+
+            node->value = node->start;
+            return 1;
+    }
+
+    return 1;
+}
+
+static size_t render_sequence(BraceNode* node, char* word) {
+    /*
+     * Writes the current combination of a chain of nodes
+     *
+     * Returns: The number of characters written
+     */
+
+    size_t length = 0;
+
+    for (; node != NULL; node = node->next) {
+        if (node->type == BRACE_TEXT) {
+            memcpy(word + length, node->text, node->length);
+            length += node->length;
+        }
+        else if (node->type == BRACE_LIST)
+            length += render_sequence(node->alternatives[node->current], word + length);
+        else if (node->is_char) {
+            // Characters that mean something in a pattern stay literal
+            if (strchr("*?[]{},\\", (int)node->value) != NULL)
+                word[length++] = '\\';
+
+            word[length++] = (char)node->value;
+        }
+        else
+            length += sprintf(word + length, "%0*ld", node->width, node->value);
+    }
+
+    return length;
+}
+
+char* brace_next(Brace* brace) {
+    /*
+     * Generates the next word of a brace word
+     *
+     * Returns: The word, with quoted characters still escaped, which is overwritten by the
+     *          next call. NULL once they've all been generated
+     */
+
+    if (brace->done)
+        return NULL;
+
+    if (brace->started && advance_sequence(brace->head)) {
+        brace->done = 1;
+        return NULL;
+    }
+
+    brace->started = 1;
+    brace->word[render_sequence(brace->head, brace->word)] = '\0';
+
+    return brace->word;
+}
+
+void brace_defer(Brace* brace, const char* word) {
+    /*
+     * Marks an argument as standing in for all the words of a brace word, so a builtin that
+     * takes its arguments lazily can generate them one at a time instead of them all being
+     * stored in the argument vector
+     *
+     * Arguments:
+     *  brace: The generator, which must be in line_arena
+     *  word: The argument put in its place, looked up by address
+     */
+
+    brace->source = word;
+    brace->next = deferred;
+    deferred = brace;
+}
+
+Brace* brace_lookup(const char* word) {
+    /*
+     * Returns: The generator an argument stands in for, or NULL if it's an ordinary argument
+     */
+
+    for (Brace* brace = deferred; brace != NULL; brace = brace->next) {
+        if (brace->source == word)
+            return brace;
+    }
+
+    return NULL;
+}
+
+Brace* brace_swap_deferred(Brace* deferred_words) {
+    /*
+     * Puts another set of deferred words in place, for a queued job that outlived the line
+     * its words were deferred on
+     *
+     * Returns: The deferred words that were in place, to put back afterwards
+     */
+
+    Brace* previous = deferred;
+    deferred = deferred_words;
+
+    return previous;
+}
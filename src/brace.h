@@ -0,0 +1,57 @@
+#ifndef BRACE_H
+#define BRACE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+typedef enum BraceNodeType {
+    BRACE_TEXT,     // literal text
+    BRACE_LIST,     // {a,b,c}
+    BRACE_RANGE     // {1..10}, {01..10..3}, {a..z}
+} BraceNodeType;
+
+// One part of a brace word. The parts of a word, or of one alternative of a list, are chained
+// through next, and the word is enumerated like an odometer with the last part turning fastest
+typedef struct BraceNode {
+    BraceNodeType type;
+    struct BraceNode* next;
+
+    const char* text;
+    size_t length;
+
+    struct BraceNode** alternatives;    // NULL for an empty alternative
+    int alternatives_num;
+    int current;
+
+    long start;
+    long end;
+    long step;
+    long value;
+    int width;      // the width numbers are zero padded to, 0 for no padding
+    int is_char;
+} BraceNode;
+
+// A lazy generator of the words a brace word expands to, which only ever holds the current one
+typedef struct Brace {
+    BraceNode* head;
+    int started;
+    int done;
+
+    char* word;
+    size_t max_length;
+
+    const char* pattern;    // the word it was parsed from
+    const char* source;     // the argument standing in for it, when it's deferred
+    struct Brace* next;
+} Brace;
+
+Brace* brace_parse(const char* pattern, Arena* arena);
+char* brace_next(Brace* brace);
+
+void brace_begin_line();
+void brace_defer(Brace* brace, const char* word);
+Brace* brace_lookup(const char* word);
+Brace* brace_swap_deferred(Brace* deferred_words);
+
+#endif
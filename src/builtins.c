@@ -0,0 +1,652 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include "main.h"
+#include "builtins.h"
+#include "cash_builtin.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "utilities.h"
+#include "jobs.h"
+#include "prompt.h"
+#include "history.h"
+#include "histindex.h"
+#include "batch.h"
+#include "parallel.h"
+#include "trace.h"
+#include "benchmark.h"
+#include "profile.h"
+#include "pipeline.h"
+
+#include "globals.h"
+
+static BuiltinRegistry registry;
+
+static const Builtin core_builtins[] = {
+    { "exit",   builtin_exit,   "exit the shell" },
+    { "cd",     builtin_cd,     "change directory" },
+    { "color",  builtin_color,  "change the accent color" },
+    { "jobs",   builtin_jobs,   "shows the background jobs and their state, -l with their resource usage" },
+    { "jobmax", builtin_jobmax, "limit how many background jobs run at once, queueing the rest" },
+    { "time",   builtin_time,   "show the time and memory every stage of a command line takes" },
+    { "bench",  builtin_bench,  "run a command line repeatedly, and show the spread of its run times" },
+    { "pipeline", builtin_pipeline, "set the pipe size and CPU pinning of pipelines, for one or all of them" },
+    { "profile", builtin_profile, "run a pipeline through the shell, and find the stage that slows it down" },
+    { "trace",  builtin_trace,  "record what the shell does, as a trace chrome://tracing can open" },
+    { "wait",   builtin_wait,   "wait for background jobs to finish" },
+    { "hash",   builtin_hash,   "show or reset the remembered command locations" },
+    { "spawn",  builtin_spawn,  "choose how commands are started, and show their spawn latency" },
+    { "enable", builtin_enable, "load builtins from shared objects, or list them" },
+    { "prompt", builtin_prompt, "show how long the prompt takes to render" },
+    { "history", builtin_history, "list or search the command history" },
+    { "batch",  builtin_batch,  "run a command on words, as many per exec as ARG_MAX allows", NULL, BUILTIN_LAZY_ARGS },
+    { "parallel", builtin_parallel, "run a command on words, a number of them at a time", NULL, BUILTIN_LAZY_ARGS },
+    { "help",   builtin_help,   "show this message" },
+
+    // Hot utilities that would otherwise cost a fork and an exec each
+    { "echo",   builtin_echo,   "write arguments to standard output", NULL, BUILTIN_STATELESS },
+    { "printf", builtin_printf, "write formatted output", NULL, BUILTIN_STATELESS },
+    { "test",   builtin_test,   "evaluate a conditional expression", NULL, BUILTIN_STATELESS },
+    { "[",      builtin_test,   "evaluate a conditional expression", NULL, BUILTIN_STATELESS },
+    { "true",   builtin_true,   "do nothing, successfully", NULL, BUILTIN_STATELESS },
+    { "false",  builtin_false,  "do nothing, unsuccessfully", NULL, BUILTIN_STATELESS },
+    { "cat",    builtin_cat,    "concatenate files to standard output", NULL, BUILTIN_STATELESS },
+};
+
+void builtins_init() {
+    /*
+     * Registers the builtins that are compiled into the shell
+     */
+
+    int count = sizeof(core_builtins) / sizeof(core_builtins[0]);
+
+    for (int i = 0; i < count; i++)
+        register_builtin(core_builtins[i].name, core_builtins[i].func, core_builtins[i].help, NULL, core_builtins[i].flags);
+}
+
+static int search(const char* name, int* position) {
+    /*
+     * Binary searches the registry
+     *
+     * Returns: 1 if found, with its index in position. 0 otherwise, with the index it would be inserted at
+     */
+
+    int low = 0, high = registry.length;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+        int cmp = strcmp(name, registry.entries[mid].name);
+
+        if (cmp == 0) {
+            *position = mid;
+            return 1;
+        }
+        else if (cmp < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    *position = low;
+    return 0;
+}
+
+int builtin_prefix_range(const char* prefix, Builtin** first) {
+    /*
+     * Finds the builtins whose names start with prefix, which are next to each other in the registry
+     *
+     * Returns: How many there are, with the first one in first
+     */
+
+    int position;
+    search(prefix, &position);
+
+    size_t length = strlen(prefix);
+    int count = 0;
+
+    while (position + count < registry.length && strncmp(registry.entries[position + count].name, prefix, length) == 0)
+        count++;
+
+    *first = &registry.entries[position];
+
+    return count;
+}
+
+Builtin* find_builtin(const char* name) {
+    /*
+     * Looks up a builtin by name
+     *
+     * Returns: The builtin, or NULL if there's none with that name
+     */
+
+    int position;
+
+    if (search(name, &position))
+        return &registry.entries[position];
+
+    return NULL;
+}
+
+int register_builtin(const char* name, cash_builtin_func func, const char* help, void* handle, int flags) {
+    /*
+     * Adds a builtin to the registry, keeping it sorted
+     *
+     * Returns: 1 on success, 0 if a builtin with that name already exists
+     */
+
+    int position;
+
+    if (search(name, &position))
+        return 0;
+
+    if (registry.length == registry.capacity) {
+        registry.capacity = (registry.capacity == 0) ? 16 : registry.capacity * 2;
+        registry.entries = realloc(registry.entries, sizeof(Builtin) * registry.capacity);
+    }
+
+    memmove(&registry.entries[position + 1], &registry.entries[position], sizeof(Builtin) * (registry.length - position));
+
+    registry.entries[position].name = name;
+    registry.entries[position].func = func;
+    registry.entries[position].help = help;
+    registry.entries[position].handle = handle;
+    registry.entries[position].flags = flags;
+    registry.length++;
+
+    return 1;
+}
+
+int unregister_builtin(const char* name) {
+    /*
+     * Removes a loaded builtin from the registry, and unloads its shared object
+     *
+     * Returns: 1 on success, 0 if there's no such loaded builtin
+     */
+
+    int position;
+
+    if (!search(name, &position) || registry.entries[position].handle == NULL)
+        return 0;
+
+    void* handle = registry.entries[position].handle;
+
+    memmove(&registry.entries[position], &registry.entries[position + 1], sizeof(Builtin) * (registry.length - position - 1));
+    registry.length--;
+
+    // Each load took its own reference on the shared object
+    dlclose(handle);
+
+    return 1;
+}
+
+static int load_builtin(const char* filename, const char* name) {
+    /*
+     * Loads the <name>_builtin descriptor from a shared object and registers it
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    void* handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+
+    if (handle == NULL) {
+        fprintf(stderr, "enable: %s\n", dlerror());
+        return 0;
+    }
+
+    char symbol[256];
+    snprintf(symbol, sizeof(symbol), "%s_builtin", name);
+
+    CashBuiltin* descriptor = dlsym(handle, symbol);
+
+    if (descriptor == NULL) {
+        fprintf(stderr, "enable: %s: no symbol '%s'\n", filename, symbol);
+        dlclose(handle);
+        return 0;
+    }
+
+    if (descriptor->abi_version != CASH_BUILTIN_ABI_VERSION || descriptor->func == NULL || descriptor->name == NULL) {
+        fprintf(stderr, "enable: %s: incompatible builtin (ABI version %d, expected %d)\n",
+                filename, descriptor->abi_version, CASH_BUILTIN_ABI_VERSION);
+        dlclose(handle);
+        return 0;
+    }
+
+    if (!register_builtin(descriptor->name, descriptor->func, descriptor->help ? descriptor->help : "", handle, 0)) {
+        fprintf(stderr, "enable: %s: a builtin with that name already exists\n", descriptor->name);
+        dlclose(handle);
+        return 0;
+    }
+
+    return 1;
+}
+
+int builtin_exit(int argc, char** argv) {
+    // exit with the given status, or with the status of the last command
+    if (argc > 1)
+        exit(atoi(argv[1]));
+
+    exit(last_exit_status);
+}
+
+int builtin_cd(int argc, char** argv) {
+    int chdir_code;
+
+    // cd into home directory if no argument is given
+    if (argc < 2)
+        chdir_code = chdir(getenv("HOME"));
+    else
+        chdir_code = chdir(argv[1]);
+
+    if (chdir_code < 0) {
+        fprintf(stderr, "%scd error%s: directory not found\n", colors[ERR_COLOR], color_reset);
+        return 1;
+    }
+
+    prompt_invalidate(PROMPT_DIR);
+
+    return 0;
+}
+
+int builtin_color(int argc, char** argv) {
+    if (argc < 2) {
+        printf("color: missing operand\nType 'color -h' for proper usage.\n");
+        return 1;
+    }
+
+    // Print help message
+    if (strcmp(argv[1], "-h") == 0) {
+        printf("usage: color [color_code]\n\n");
+        printf("valid color codes:\n");
+        printf("  0 -> red\n");
+        printf("  1 -> green\n");
+        printf("  2 -> yellow\n");
+        printf("  3 -> blue\n");
+        printf("  4 -> purple\n");
+        printf("  5 -> cyan\n");
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    long value = strtol(argv[1], &end, 10);
+
+    // Handle error
+    if (end == argv[1] || *end != '\0' || errno == ERANGE || value > 5 || value < 0) {
+        printf("color: invalid operand\n Type 'color -h' for proper usage.\n");
+        return 1;
+    }
+
+    accent_color = value;
+    prompt_invalidate(PROMPT_COLOR);
+
+    return 0;
+}
+
+int builtin_jobs(int argc, char** argv) {
+    jobs_print(argc > 1 && strcmp(argv[1], "-l") == 0);
+
+    return 0;
+}
+
+int builtin_jobmax(int argc, char** argv) {
+    if (argc < 2) {
+        if (job_table.max_running > 0)
+            printf("%d\n", job_table.max_running);
+        else
+            printf("unlimited\n");
+
+        return 0;
+    }
+
+    char* end;
+    long max = strtol(argv[1], &end, 10);
+
+    if (*end != '\0' || end == argv[1] || max < 0) {
+        fprintf(stderr, "usage: jobmax [count], 0 for no limit\n");
+        return 2;
+    }
+
+    job_table.max_running = max;
+
+    // A higher limit lets queued jobs start right away
+    jobs_start_queued();
+
+    return 0;
+}
+
+int builtin_wait(int argc, char** argv) {
+    if (argc < 2)
+        return jobs_wait(0);
+
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        Job* job;
+
+        if (argv[i][0] == '%')
+            job = job_by_id(atoi(argv[i] + 1));
+        else {
+            pid_t pid = atoi(argv[i]);
+
+            // Finished jobs are out of the pid index, but stay in the table until they're reported
+            job = job_by_pid(pid);
+            for (int j = 1; job == NULL && j <= job_table.slots_used; j++) {
+                if (job_by_id(j) != NULL && job_by_id(j)->pid == pid)
+                    job = job_by_id(j);
+            }
+        }
+
+        if (job == NULL) {
+            fprintf(stderr, "%serror%s: wait: no such job: %s\n", colors[ERR_COLOR], color_reset, argv[i]);
+            status = 127;
+            continue;
+        }
+
+        status = jobs_wait(job->id);
+    }
+
+    return status;
+}
+
+int builtin_time(int argc, char** argv) {
+    // Only reached when "time" isn't the first word of the line, where execute_line() handles it
+    fprintf(stderr, "usage: time command [| command ...], or time on its own for the last command line\n");
+
+    return 2;
+}
+
+int builtin_profile(int argc, char** argv) {
+    // Only reached when "profile" isn't the first word of the line, where execute_line() handles it
+    profile_print_usage();
+
+    return 2;
+}
+
+int builtin_trace(int argc, char** argv) {
+    if (argc < 2 || strcmp(argv[1], "status") == 0) {
+        trace_print_status();
+        return 0;
+    }
+
+    if (strcmp(argv[1], "on") == 0 && argc <= 3) {
+        if (!trace_start(argc == 3 ? argv[2] : TRACE_DEFAULT_FILE)) {
+            fprintf(stderr, "%serror%s: trace: out of memory\n", colors[ERR_COLOR], color_reset);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (strcmp(argv[1], "off") == 0 && argc == 2) {
+        trace_stop();
+        return 0;
+    }
+
+    printf("usage: trace [on [file] | off | status]\n\n");
+    printf("  trace on [file]  record parsing, spawning, waiting and builtins, to %s by default\n", TRACE_DEFAULT_FILE);
+    printf("  trace off        stop, and write the trace file\n");
+    printf("  trace status     show where the trace goes and how many events it has\n\n");
+    printf("  CASH_TRACE=file also turns it on from the start. The trace is written when the shell exits\n");
+
+    return strcmp(argv[1], "-h") == 0 ? 0 : 2;
+}
+
+int builtin_hash(int argc, char** argv) {
+    if (argc < 2) {
+        path_cache_print();
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-r") == 0) {
+        path_cache_clear();
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-h") == 0) {
+        printf("usage: hash [-r] [name ...]\n\n");
+        printf("  hash           show the remembered command locations\n");
+        printf("  hash name ...  look up and remember the given commands\n");
+        printf("  hash -r        forget every remembered location\n");
+        return 0;
+    }
+
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (path_lookup(argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+int builtin_spawn(int argc, char** argv) {
+    // Without arguments show the backends with their measured latency
+    if (argc < 2)
+        spawn_print_stats();
+    else if (strcmp(argv[1], "-r") == 0)
+        spawn_reset_stats();
+    else if (strcmp(argv[1], "-h") == 0) {
+        printf("usage: spawn [backend | -r]\n\n");
+        printf("  spawn          show the spawn latency of each backend\n");
+        printf("  spawn backend  use posix_spawn, vfork or fork to start commands\n");
+        printf("  spawn -r       reset the latency statistics\n");
+    }
+    else if (!spawn_set_backend(argv[1])) {
+        printf("spawn: unknown backend '%s'\n Type 'spawn -h' for proper usage.\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void print_history_usage() {
+    printf("usage: history [-n count] [-d] [-s status] [-f] [-v] [query]\n\n");
+    printf("  history        list the last commands, oldest first\n");
+    printf("  history query  search the history, best match first\n\n");
+    printf("  -n count   show this many commands (default %d)\n", HISTORY_LIST_DEFAULT);
+    printf("  -d         only commands run in the current directory\n");
+    printf("  -s status  only commands that exited with this status\n");
+    printf("  -f         fuzzy search, matching the query's characters in order\n");
+    printf("  -v         show where and when each command ran, and how long the search took\n");
+}
+
+int builtin_history(int argc, char** argv) {
+    int limit = HISTORY_LIST_DEFAULT;
+    int options = 0;
+    int status = -1;
+    int verbose = 0;
+    char* query = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            print_history_usage();
+            return 0;
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            limit = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            status = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0)
+            options |= SEARCH_CWD;
+        else if (strcmp(argv[i], "-f") == 0)
+            options |= SEARCH_FUZZY;
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = 1;
+        else if (argv[i][0] == '-' || query != NULL) {
+            print_history_usage();
+            return 2;
+        }
+        else
+            query = argv[i];
+    }
+
+    if (limit <= 0)
+        return 0;
+
+    // Scripts don't record history, but can still read it
+    if (history_store.path == NULL)
+        history_init();
+
+    if (query == NULL) {
+        char cwd[PATH_MAX];
+        if ((options & SEARCH_CWD) && getcwd(cwd, sizeof(cwd)) == NULL)
+            return 1;
+
+        history_sync();
+
+        // Walk back to the oldest of the last entries that pass the filters, then print them forward
+        size_t offset = history_store.map_size;
+        size_t start = offset;
+        const HistoryRecord* record;
+
+        for (int found = 0; found < limit && (record = history_prev(&offset)) != NULL;) {
+            if ((options & SEARCH_CWD) && strcmp(history_cwd(record), cwd) != 0)
+                continue;
+            if (status != -1 && record->status != status)
+                continue;
+
+            start = offset;
+            found++;
+        }
+
+        offset = start;
+
+        while ((record = history_next(&offset)) != NULL) {
+            if ((options & SEARCH_CWD) && strcmp(history_cwd(record), cwd) != 0)
+                continue;
+            if (status != -1 && record->status != status)
+                continue;
+
+            char date[32];
+            time_t when = record->time;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&when));
+
+            printf("%s  %3d  %s", date, record->status, history_command(record));
+
+            if (verbose)
+                printf("  (%s)", history_cwd(record));
+
+            printf("\n");
+        }
+
+        return 0;
+    }
+
+    if (limit > HISTINDEX_MAX_RESULTS)
+        limit = HISTINDEX_MAX_RESULTS;
+
+    HistResult results[HISTINDEX_MAX_RESULTS];
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int length = histindex_search(query, options, status, results, limit);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < length; i++) {
+        const HistPlace* place = histindex_place(&results[i]);
+
+        if (verbose)
+            printf("%8.1f  %-5u  %3d  %s  (%s)\n", results[i].score, place->count, place->last_status,
+                    histindex_command(&results[i]), place->cwd);
+        else
+            printf("%s\n", histindex_command(&results[i]));
+    }
+
+    if (verbose)
+        printf("%d results in %.1f us\n", length,
+                ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3);
+
+    return 0;
+}
+
+int builtin_prompt(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "-r") == 0)
+        prompt_reset_stats();
+    else if (argc > 1 && strcmp(argv[1], "-h") == 0) {
+        printf("usage: prompt [-r]\n\n");
+        printf("  prompt     show the render count and render time of the prompt\n");
+        printf("  prompt -r  reset the statistics\n");
+    }
+    else
+        prompt_print_stats();
+
+    return 0;
+}
+
+int builtin_enable(int argc, char** argv) {
+    // List every builtin, marking the loaded ones
+    if (argc < 2) {
+        for (int i = 0; i < registry.length; i++)
+            printf("enable %s%s\n", registry.entries[i].name, registry.entries[i].handle ? " (loaded)" : "");
+
+        return 0;
+    }
+
+    if (strcmp(argv[1], "-h") == 0) {
+        printf("usage: enable [-f file name ... | -d name ...]\n\n");
+        printf("  enable                 list the builtins\n");
+        printf("  enable -f file name    load the builtin 'name' from the shared object 'file'\n");
+        printf("  enable -d name         unload a builtin loaded with -f\n");
+        return 0;
+    }
+
+    int status = 0;
+
+    if (strcmp(argv[1], "-f") == 0) {
+        if (argc < 4) {
+            printf("enable: missing operand\n Type 'enable -h' for proper usage.\n");
+            return 1;
+        }
+
+        for (int i = 3; i < argc; i++) {
+            if (!load_builtin(argv[2], argv[i]))
+                status = 1;
+        }
+    }
+    else if (strcmp(argv[1], "-d") == 0) {
+        for (int i = 2; i < argc; i++) {
+            if (!unregister_builtin(argv[i])) {
+                fprintf(stderr, "enable: %s: not a loaded builtin\n", argv[i]);
+                status = 1;
+            }
+        }
+    }
+    else {
+        printf("enable: invalid operand\n Type 'enable -h' for proper usage.\n");
+        status = 1;
+    }
+
+    return status;
+}
+
+int builtin_help(int argc, char** argv) {
+    // Display help message
+    printf("built-in commands:\n");
+
+    for (int i = 0; i < registry.length; i++)
+        printf("  %s: %s\n", registry.entries[i].name, registry.entries[i].help);
+
+    printf("\nfeatures:\n");
+    printf("  - history shared between sessions, tab completion, and readline keybinds\n");
+    printf("  - running processes in the background ('&'), or a number at a time with parallel\n");
+    printf("  - pipes ('|'), builtins run inside pipelines without an exec\n");
+    printf("  - I/O redirection ('>', '>>', '<')\n");
+    printf("  - scripts ('cash script'), command strings ('cash -c') and piped input\n");
+    printf("  - string quotes and escapes (e.g: \"hello\", 'hello', hello\\ world)\n");
+    printf("  - globs ('*', '?', '[...]', '**')\n");
+    printf("  - brace lists and sequences ('{a,b}', '{1..10}'), generated lazily for batch\n");
+
+    return 0;
+}
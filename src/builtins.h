@@ -0,0 +1,50 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "cash_builtin.h"
+
+// Set on builtins that don't touch the shell's state, so they can run in the shell
+// process even as the last stage of a pipeline
+#define BUILTIN_STATELESS 1
+
+// Set on builtins that take the brace words after a ":::" argument lazily, see brace_lookup()
+#define BUILTIN_LAZY_ARGS 2
+
+typedef struct Builtin {
+    const char* name;
+    cash_builtin_func func;
+    const char* help;
+    void* handle;       // the shared object a loaded builtin came from, NULL for our own
+    int flags;
+} Builtin;
+
+// Builtins sorted by name, searched with a binary search
+typedef struct BuiltinRegistry {
+    Builtin* entries;
+    int length;
+    int capacity;
+} BuiltinRegistry;
+
+void builtins_init();
+Builtin* find_builtin(const char* name);
+int builtin_prefix_range(const char* prefix, Builtin** first);
+int register_builtin(const char* name, cash_builtin_func func, const char* help, void* handle, int flags);
+int unregister_builtin(const char* name);
+
+int builtin_exit(int argc, char** argv);
+int builtin_cd(int argc, char** argv);
+int builtin_color(int argc, char** argv);
+int builtin_jobs(int argc, char** argv);
+int builtin_jobmax(int argc, char** argv);
+int builtin_wait(int argc, char** argv);
+int builtin_time(int argc, char** argv);
+int builtin_profile(int argc, char** argv);
+int builtin_trace(int argc, char** argv);
+int builtin_hash(int argc, char** argv);
+int builtin_spawn(int argc, char** argv);
+int builtin_prompt(int argc, char** argv);
+int builtin_history(int argc, char** argv);
+int builtin_enable(int argc, char** argv);
+int builtin_help(int argc, char** argv);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef CASH_BUILTIN_H
+#define CASH_BUILTIN_H
+
+/*
+ * The interface for builtins loaded at runtime with 'enable -f lib.so name'.
+ *
+ * A loadable builtin is a shared object that exports a CashBuiltin named <name>_builtin:
+ *
+ *     #include "cash_builtin.h"
+ *
+ *     static int hello(int argc, char** argv) {
+ *         printf("hello from %s\n", argv[0]);
+ *         return 0;
+ *     }
+ *
+ *     CashBuiltin hello_builtin = { CASH_BUILTIN_ABI_VERSION, "hello", hello, "say hello" };
+ *
+ * Build it with: gcc -shared -fPIC -o hello.so hello.c
+ *
+ * The function runs inside the shell process. It gets a NULL terminated argv, writes to
+ * stdout and stderr, and returns the command's exit status.
+ */
+
+#define CASH_BUILTIN_ABI_VERSION 1
+
+typedef int (*cash_builtin_func)(int argc, char** argv);
+
+typedef struct CashBuiltin {
+    int abi_version;
+    const char* name;
+    cash_builtin_func func;
+    const char* help;
+} CashBuiltin;
+
+#endif
@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <readline/readline.h>
+
+#include "complete.h"
+#include "builtins.h"
+
+#include "globals.h"
+
+// Only the main thread uses the current index. The builder hands a new one over through pending
+static CommandIndex* current = NULL;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static CommandIndex* pending = NULL;
+static int building = 0;
+
+static void free_index(CommandIndex* index) {
+    if (index == NULL)
+        return;
+
+    for (int i = 0; i < index->dirs_num; i++)
+        free(index->dirs[i].name);
+
+    free(index->dirs);
+    free(index->path_env);
+    free(index->names);
+    arena_release(&index->strings);
+    free(index);
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static int is_executable(int dir_fd, struct dirent* entry) {
+    if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+        return 0;
+
+    // Links and file systems without d_type need a look at what's there
+    if (entry->d_type != DT_REG) {
+        struct stat st;
+
+        if (fstatat(dir_fd, entry->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode))
+            return 0;
+    }
+
+    return faccessat(dir_fd, entry->d_name, X_OK, 0) == 0;
+}
+
+static void* build_main(void* arg) {
+    /*
+     * Lists the executables in every absolute PATH directory. Directories are stat()ed
+     * before they are read, so a change made while reading shows up as stale next time
+     */
+
+    CommandIndex* index = calloc(1, sizeof(CommandIndex));
+    index->path_env = arg;
+
+    index->dirs_num = 1;
+    for (const char* c = index->path_env; *c; c++) {
+        if (*c == ':')
+            index->dirs_num++;
+    }
+
+    index->dirs = calloc(index->dirs_num, sizeof(PathDir));
+
+    int capacity = 1024;
+    index->names = malloc(capacity * sizeof(char*));
+
+    const char* start = index->path_env;
+    for (int i = 0; i < index->dirs_num; i++) {
+        const char* end = strchr(start, ':');
+        size_t len = (end != NULL) ? (size_t) (end - start) : strlen(start);
+
+        PathDir* dir = &index->dirs[i];
+        dir->name = strndup(start, len);
+        start = end + 1;
+
+        // Relative directories depend on where we are, those are left to filename completion
+        struct stat st;
+        if (dir->name[0] != '/' || stat(dir->name, &st) == -1)
+            continue;
+
+        dir->mtime = st.st_mtim;
+        dir->mtime_known = 1;
+
+        DIR* stream = opendir(dir->name);
+        if (stream == NULL)
+            continue;
+
+        struct dirent* entry;
+        while ((entry = readdir(stream)) != NULL) {
+            if (entry->d_name[0] == '.' || !is_executable(dirfd(stream), entry))
+                continue;
+
+            if (index->length == capacity) {
+                capacity *= 2;
+                index->names = realloc(index->names, capacity * sizeof(char*));
+            }
+
+            index->names[index->length++] = arena_strdup(&index->strings, entry->d_name);
+        }
+
+        closedir(stream);
+    }
+
+    qsort(index->names, index->length, sizeof(char*), compare_names);
+
+    // The same command in several directories is listed once
+    int unique = 0;
+    for (int i = 0; i < index->length; i++) {
+        if (unique == 0 || strcmp(index->names[unique - 1], index->names[i]) != 0)
+            index->names[unique++] = index->names[i];
+    }
+    index->length = unique;
+
+    pthread_mutex_lock(&lock);
+
+    free_index(pending);
+    pending = index;
+    building = 0;
+
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+static const char* path_env() {
+    const char* path = getenv("PATH");
+    return (path != NULL) ? path : DEFAULT_PATH;
+}
+
+static void start_build() {
+    pthread_mutex_lock(&lock);
+
+    if (building) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    building = 1;
+    pthread_mutex_unlock(&lock);
+
+    // Like every helper thread, it leaves the signals to the main thread
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+
+    pthread_t builder;
+    if (pthread_create(&builder, NULL, build_main, strdup(path_env())) == 0)
+        pthread_detach(builder);
+    else
+        building = 0;
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+static int index_stale() {
+    /*
+     * Returns: 1 if PATH or one of its directories changed since the index was built
+     */
+
+    if (strcmp(current->path_env, path_env()) != 0)
+        return 1;
+
+    for (int i = 0; i < current->dirs_num; i++) {
+        PathDir* dir = &current->dirs[i];
+        struct stat st;
+
+        if (dir->name[0] != '/')
+            continue;
+
+        int exists = (stat(dir->name, &st) == 0);
+
+        if (exists != dir->mtime_known)
+            return 1;
+
+        if (exists && (st.st_mtim.tv_sec != dir->mtime.tv_sec || st.st_mtim.tv_nsec != dir->mtime.tv_nsec))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void refresh_index() {
+    /*
+     * Takes the index the builder finished, and starts a new build if it's out of date.
+     * Until that one is done the old index is still used
+     */
+
+    pthread_mutex_lock(&lock);
+
+    if (pending != NULL) {
+        free_index(current);
+        current = pending;
+        pending = NULL;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (current == NULL || index_stale())
+        start_build();
+}
+
+static int lower_bound(const char* prefix) {
+    int low = 0, high = current->length;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if (strcmp(current->names[mid], prefix) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static char* command_generator(const char* text, int state) {
+    /*
+     * Hands readline the builtins, then the PATH commands, starting with text
+     */
+
+    static Builtin* builtins;
+    static int builtins_left;
+    static int position;
+
+    size_t length = strlen(text);
+
+    if (state == 0) {
+        builtins_left = builtin_prefix_range(text, &builtins);
+        position = (current != NULL) ? lower_bound(text) : 0;
+    }
+
+    if (builtins_left > 0) {
+        builtins_left--;
+        return strdup((builtins++)->name);
+    }
+
+    if (current != NULL && position < current->length && strncmp(current->names[position], text, length) == 0)
+        return strdup(current->names[position++]);
+
+    return NULL;
+}
+
+static int command_position(int start) {
+    /*
+     * Returns: 1 if the word starting at start is the command of its pipeline stage
+     */
+
+    int i = start - 1;
+
+    while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t'))
+        i--;
+
+    return i < 0 || rl_line_buffer[i] == '|';
+}
+
+static char** attempt_completion(const char* text, int start, int end) {
+    /*
+     * Completes commands from the builtins and PATH, and leaves everything else, including
+     * paths to commands, to readline's filename completion
+     */
+
+    if (!command_position(start) || strchr(text, '/') != NULL)
+        return NULL;
+
+    refresh_index();
+
+    return rl_completion_matches(text, command_generator);
+}
+
+void complete_init() {
+    /*
+     * Registers command completion with readline, and starts indexing PATH in the background
+     * so the first Tab doesn't wait for it
+     */
+
+    rl_attempted_completion_function = attempt_completion;
+
+    start_build();
+}
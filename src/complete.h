@@ -0,0 +1,20 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include "arena.h"
+#include "pathcache.h"
+
+// The executables found in PATH, sorted, as of the directory mtimes it was built with
+typedef struct CommandIndex {
+    char** names;
+    int length;
+    Arena strings;
+
+    char* path_env;
+    PathDir* dirs;
+    int dirs_num;
+} CommandIndex;
+
+void complete_init();
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +8,7 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #include <readline/readline.h>
@@ -14,15 +17,151 @@
 #include "main.h"
 #include "execute.h"
 #include "parse.h"
+#include "lex.h"
+#include "argvec.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "usage.h"
+#include "trace.h"
+#include "benchmark.h"
+#include "profile.h"
+#include "pipeline.h"
 
 #include "globals.h"
 
 #define PREAD  0
 #define PWRITE 1
 
+extern char** environ;
+
+int execute_line(char* line) {
+    /*
+     * Parses and executes a single command line, then releases everything it allocated
+     *
+     * Arguments:
+     *  line: The null terminated command line
+     *
+     * Returns: The exit status of the line
+     */
+
+    long long line_start = trace_begin();
+
+    long long span = trace_begin();
+    char** input = parse_input(line);
+    trace_end("parse", span, -1, -1, NULL);
+
+    // Syntax errors get the same status as in other shells
+    if (input == NULL) {
+        arena_reset(&line_arena);
+        last_exit_status = 2;
+        return last_exit_status;
+    }
+
+    // A leading "pipeline" sets up pipes and stages differently, for the rest of the line or from now on
+    if (input[0] != NULL && strcmp(input[0], "pipeline") == 0) {
+        int used = pipeline_configure(input);
+
+        if (used == -1 || input[used] == NULL) {
+            arena_reset(&line_arena);
+            return last_exit_status = (used == -1) ? 2 : 0;
+        }
+
+        input += used;
+    }
+
+    // A leading "bench" runs the rest of the line over and over, and reports how long it took
+    if (input[0] != NULL && strcmp(input[0], "bench") == 0) {
+        last_exit_status = benchmark_line(input);
+        trace_end("line", line_start, -1, -1, line);
+
+        pipeline_end_line();
+        arena_reset(&line_arena);
+        fflush(stdout);
+
+        return last_exit_status;
+    }
+
+    // A leading "time" reports what each stage of the line used. On its own it shows the last line
+    int timed = input[0] != NULL && strcmp(input[0], "time") == 0;
+
+    if (timed && input[1] == NULL) {
+        usage_print();
+        pipeline_end_line();
+        arena_reset(&line_arena);
+        return last_exit_status;
+    }
+
+    // A leading "profile" relays the pipes of the line through the shell, to find its bottleneck
+    int profiled = input[0] != NULL && strcmp(input[0], "profile") == 0;
+
+    if (profiled && (input[1] == NULL || input[1][0] == '-')) {
+        profile_print_usage();
+        pipeline_end_line();
+        arena_reset(&line_arena);
+        return last_exit_status = 2;
+    }
+
+    if (timed || profiled) {
+        input++;
+        usage_begin(0, 1);
+    }
+    else
+        line_usage.precise = 0;
+
+    span = trace_begin();
+    char*** array_of_inputs = separate_inputs(input);
+    trace_end("separate", span, -1, -1, NULL);
+
+    if (profiled && array_of_inputs == NULL) {
+        fprintf(stderr, "%serror%s: profile: not a pipeline, there's nothing to profile\n", colors[ERR_COLOR], color_reset);
+        pipeline_end_line();
+        arena_reset(&line_arena);
+        return last_exit_status = 2;
+    }
+
+    pipeline_profiling = profiled;
+
+    if (array_of_inputs == NULL)
+        execute_input(input);
+    else
+        execute_piped_inputs(array_of_inputs);
+
+    pipeline_profiling = 0;
+
+    // Background jobs are accounted for in jobs -l instead
+    if (timed && line_usage.stages_num > 0)
+        usage_print();
+
+    trace_end("line", line_start, -1, -1, line);
+
+    // Everything the line needed is gone at once
+    pipeline_end_line();
+    arena_reset(&line_arena);
+
+    // Builtin output must not lag behind the output of later commands
+    fflush(stdout);
+
+    return last_exit_status;
+}
+
+int exit_status(int wait_status) {
+    /*
+     * Converts a status returned by waitpid() to a shell exit status
+     */
+
+    if (WIFEXITED(wait_status))
+        return WEXITSTATUS(wait_status);
+    else if (WIFSIGNALED(wait_status))
+        return 128 + WTERMSIG(wait_status);
+
+    return 1;
+}
+
 void execute_input(char** input) {
     /*
-     * Takes a parsed array of strings and performs the according fork-exec
+     * Takes a parsed array of strings and spawns the according process
      *
      * Arguments:
      *  input: A null terminated array of char pointers (strings)
@@ -34,203 +173,262 @@ void execute_input(char** input) {
     else if (input[0] == NULL)
         return;
 
-    if (execute_builtin(input))
-        return;
-
-    int input_len;
-
     // Index of the last argument (bec the actual last element in this vector is NULL)
     int last_arg = 0;
     while (input[last_arg] != NULL)
         last_arg++;
-    input_len = last_arg;
     last_arg--;
 
     // Flag that decides whether to run the command in the background or not
     int run_in_background = 0;
 
     // If a '&' is provided as the last argument, set up command to run in the background
-    if (strcmp(input[last_arg], "&") == 0) {
+    if (is_operator(input[last_arg], TOK_AMP)) {
 
         if (last_arg == 0) {
             fprintf(stderr, "%serror%s: no command supplied\n", colors[ERR_COLOR], color_reset);
+            last_exit_status = 2;
             return;
         }
 
         // Erase the '&' sign
-        free(input[last_arg]);
         input[last_arg] = NULL;
 
         // Set the flag
         run_in_background = 1;
+    }
+
+    SpawnRequest request;
+    spawn_request_init(&request, input);
 
-        // Set up signal handler for when the background process terminates
-        struct sigaction sa;
-        sa.sa_flags = SA_SIGINFO;
-        sa.sa_sigaction = sigchld_handler;
-        sigemptyset(&sa.sa_mask);
+    // Background processes get /dev/null for all I/O, unless redirected explicitly
+    if (run_in_background) {
+        int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
 
-        sigaction(SIGCHLD, &sa, NULL);
+        for (int i = 0; i < 3; i++)
+            request.fds[i] = null_fd;
+    }
 
+    if (!open_io_redirection(input, request.fds)) {
+        close_request_fds(&request);
+        last_exit_status = 1;
+        return;
     }
 
-    // Create a child proces that is a fork (clone) of the current one
-    pid_t fork_pid = fork();
-
-    if (fork_pid < 0) {
-        // Fork failed
-        fprintf(stderr, "%serror%s: fork failed\n", colors[ERR_COLOR], color_reset);
-        exit(1);
-    } 
-    else if (fork_pid == 0) {
-        // If the fork is successful, create a new process that will overwrite the
-        // child process, with any command you run
-
-        // Redirect all I/O to /dev/null
-        if (run_in_background) {
-            redirect_io("/dev/null", STDOUT_FILENO, 0);
-            redirect_io("/dev/null", STDIN_FILENO, 0);
-            redirect_io("/dev/null", STDERR_FILENO, 0);
+    pid_t pid;
+    Builtin* builtin = find_builtin(input[0]);
+
+    if (builtin != NULL) {
+        // Builtins run in the shell itself, unless they have to run alongside it
+        if (!run_in_background) {
+            usage_begin(1, line_usage.precise);
+            usage_builtin_begin(0, input[0]);
+
+            last_exit_status = run_builtin(builtin, input, request.fds);
+            close_request_fds(&request);
+
+            usage_builtin_end(0, last_exit_status);
+            return;
         }
-        else {
-            int redirect_index = handle_io_redirection(input);
-            
-            if (redirect_index != -1) {
-                for (int i = redirect_index; i < input_len; i++) {
-                    free(input[i]);
-                    input[i] = NULL;
-                }
-            }
+
+        if (jobs_should_queue()) {
+            queue_background_job(input, builtin, NULL, request.fds);
+            return;
         }
 
-        execvp(input[0], input);
+        pid = fork_builtin(builtin, input, request.fds);
+        close_request_fds(&request);
 
-        // execvp never returns if it failed, so this normaly won't execute
-        fprintf(stderr, "%serror%s: command '%s' not found\n", colors[ERR_COLOR], color_reset, input[0]);
-        exit(EXIT_FAILURE);
+        if (pid == -1) {
+            fprintf(stderr, "%serror%s: fork failed\n", colors[ERR_COLOR], color_reset);
+            last_exit_status = 1;
+            return;
+        }
     }
     else {
-        // Make the parent process wait for the child process (our command) to finish running
-        // if the command is to be ran in the background, we don't wait
-        if (!run_in_background)
-            waitpid(fork_pid, NULL, 0);
-        else {
-            rl_save_prompt();
-            // printf("[%d] started in the background\n", fork_pid);
-            add_bg_process(fork_pid, input);
-            rl_restore_prompt();
-            
-            waitpid(-1, NULL, WNOHANG);
+        if (!check_arg_max(input)) {
+            close_request_fds(&request);
+            last_exit_status = 126;
+            return;
+        }
+
+        // Unknown commands are rejected without starting a process
+        request.path = path_lookup(input[0]);
+
+        if (request.path == NULL) {
+            close_request_fds(&request);
+            report_command_not_found(input[0]);
+            return;
+        }
+
+        if (run_in_background && jobs_should_queue()) {
+            queue_background_job(input, NULL, request.path, request.fds);
+            return;
+        }
+
+        pid = spawn_process(&request);
+        close_request_fds(&request);
+
+        if (pid == -1) {
+            report_spawn_error(input[0]);
+            return;
         }
     }
+
+    report_startup_latency();
+
+    // Make the parent process wait for the child process (our command) to finish running
+    // if the command is to be ran in the background, we don't wait
+    if (!run_in_background) {
+        usage_begin(1, line_usage.precise);
+        usage_spawned(0, input[0], pid);
+        usage_wait(&pid, 1);
+
+        last_exit_status = line_usage.stages[0].status;
+    }
+    else {
+        rl_save_prompt();
+        job_add(pid, input);
+        rl_restore_prompt();
+
+        last_exit_status = 0;
+    }
 }
 
-int execute_builtin(char** input) {
+void queue_background_job(char** input, Builtin* builtin, char* path, int fds[3]) {
     /*
-     * Takes a parsed array of strings and checks if it's a built in command
-     *
-     * Arguments:
-     *  input: A null terminated array of char pointers (strings)
-     *
-     *  Returns: 1 if a built-in command was executed, 0 otherwise
+     * Hands a background job to the job queue instead of starting it, because jobmax jobs
+     * are already running. The queue takes over the descriptors
      */
 
-    if (strcmp(input[0], "exit") == 0)
-        exit(0);
-    else if (strcmp(input[0], "cd") == 0) {
+    rl_save_prompt();
+    job_queue(input, builtin != NULL, path, fds);
+    rl_restore_prompt();
 
-        int chdir_code;
+    last_exit_status = 0;
+}
 
-        // cd into home directory if no argument is given
-        if (input[1] == NULL)
-            chdir_code = chdir(getenv("HOME"));
-        else
-            chdir_code = chdir(input[1]);
+void report_spawn_error(char* command) {
+    /*
+     * Reports why spawn_process() failed, from errno, and sets the matching exit status
+     */
+
+    if (errno == ENOENT)
+        report_command_not_found(command);
+    else {
+        fprintf(stderr, "%serror%s: %s: %s\n", colors[ERR_COLOR], color_reset, command, strerror(errno));
+        last_exit_status = 126;
+    }
+}
 
-        if (chdir_code < 0)
-            fprintf(stderr, "%scd error%s: directory not found\n", colors[ERR_COLOR], color_reset);
+void report_command_not_found(char* command) {
+    fprintf(stderr, "%serror%s: command '%s' not found\n", colors[ERR_COLOR], color_reset, command);
+    last_exit_status = 127;
+}
+
+void close_request_fds(SpawnRequest* request) {
+    /*
+     * Closes the descriptors the shell opened for a child once it has been started.
+     * The same descriptor may be used for several streams
+     */
 
-        return 1;
+    for (int i = 0; i < 3; i++) {
+        int fd = request->fds[i];
+
+        if (fd == -1)
+            continue;
+
+        close(fd);
+
+        for (int j = i; j < 3; j++) {
+            if (request->fds[j] == fd)
+                request->fds[j] = -1;
+        }
     }
-    else if (strcmp(input[0], "color") == 0) {
+}
 
-        if (input[1] == NULL)
-            printf("color: missing operand\nType 'color -h' for proper usage.\n");
-        else {
-            // Print help message
-            if (strcmp(input[1], "-h") == 0) {
-                printf("usage: color [color_code]\n\n");
-                printf("valid color codes:\n");
-                printf("  0 -> red\n");
-                printf("  1 -> green\n");
-                printf("  2 -> yellow\n");
-                printf("  3 -> blue\n");
-                printf("  4 -> purple\n");
-                printf("  5 -> cyan\n");
-                return 1;
-            }
+int run_builtin(Builtin* builtin, char** input, int fds[3]) {
+    /*
+     * Runs a builtin in the shell process, with its I/O temporarily moved to the given descriptors
+     *
+     * Arguments:
+     *  builtin: The builtin to run
+     *  input: A null terminated array of char pointers (strings), with redirections already cut off
+     *  fds: The descriptors for stdin, stdout and stderr, -1 to keep ours
+     *
+     * Returns: The builtin's exit status
+     */
+
+    int saved_fds[3] = { -1, -1, -1 };
 
-            char *end;
-            long value = strtol(input[1], &end, 10); 
+    fflush(stdout);
+    fflush(stderr);
 
-            // Handle error
-            if (end == input[1] || *end != '\0' || errno == ERANGE)
-                printf("color: invalid operand\n Type 'color -h' for proper usage.\n");
-            else if (value > 5 || value < 0)
-                printf("color: invalid operand\n Type 'color -h' for proper usage.\n");
-            else
-                accent_color = value;
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != -1 && fds[i] != i) {
+            saved_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, 10);
+            dup2(fds[i], i);
         }
+    }
+
+    int argc = 0;
+    while (input[argc] != NULL)
+        argc++;
+
+    long long span = trace_begin();
+    int status = builtin->func(argc, input);
+
+    fflush(stdout);
+    fflush(stderr);
+    trace_end("builtin", span, -1, -1, builtin->name);
 
-        return 1;
+    for (int i = 0; i < 3; i++) {
+        if (saved_fds[i] != -1) {
+            dup2(saved_fds[i], i);
+            close(saved_fds[i]);
+        }
     }
-    else if (strcmp(input[0], "jobs") == 0) {
 
-        int count = 0;
+    return status;
+}
 
-        printf("currently running:\n");
+pid_t fork_builtin(Builtin* builtin, char** input, int fds[3]) {
+    /*
+     * Runs a builtin in a forked child, for when it has to run concurrently with the shell.
+     * The child never execs
+     *
+     * Returns: The child's pid, or -1 if the fork failed
+     */
 
-        for (int i = 0; i < MAX_BG_PROC; i++) {
-            if (bg_processes[i].pid != -1) {
-                printf("[%s%d%s] ", colors[PID_COLOR], bg_processes[i].pid, color_reset);
+    fflush(stdout);
+    fflush(stderr);
 
-                int j = 0;
-                while (bg_processes[i].command[j] != NULL) {
-                    printf("%s ", bg_processes[i].command[j]);
-                    j++;
-                }
+    pid_t pid = fork();
 
-                printf("\n");
-                count++;
-            }
+    if (pid == 0) {
+        for (int i = 0; i < 3; i++) {
+            if (fds[i] != -1 && fds[i] != i)
+                dup2(fds[i], i);
         }
 
-        if (count == 0)
-            printf("none\n");
+        sigprocmask(SIG_SETMASK, &spawn_sigmask, NULL);
 
-        return 1;
-    }
-    // Display help message
-    else if (strcmp(input[0], "help") == 0) {
-
-        printf("built-in commands:\n");
-        printf("  exit: exit the shell\n");
-        printf("  cd: change directory\n");
-        printf("  color: change the accent color\n");
-        printf("  jobs: shows the processes running in the background\n");
-        printf("  help: show this message\n\n");
-
-        printf("features:\n");
-        printf("  - history, tab completion, and readline keybinds\n");
-        printf("  - running processes in the background ('&')\n");
-        printf("  - pipes ('|')\n");
-        printf("  - I/O redirection ('>', '>>', '<')\n");
-        printf("  - string quotes (e.g: \"hello\")\n");
-
-        return 1;
+        // Without an exec nothing gets closed for us, and a pipe end left open
+        // would keep the other side of a pipeline from ever seeing EOF
+        close_range(3, ~0U, 0);
+
+        int argc = 0;
+        while (input[argc] != NULL)
+            argc++;
+
+        int status = builtin->func(argc, input);
+
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
     }
 
-    return 0;
+    return pid;
 }
 
 void execute_piped_inputs(char*** array_of_inputs) {
@@ -246,182 +444,293 @@ void execute_piped_inputs(char*** array_of_inputs) {
     while (array_of_inputs[inputs_num] != NULL)
         inputs_num++;
 
-    int pipes_num = inputs_num - 1;
-
-    // 2D array of pipes file descriptors
-    int** pipes_fds = malloc(sizeof(int*) * pipes_num);
-    for (int i = 0; i < pipes_num; i++)
-        pipes_fds[i] = malloc(sizeof(int) * 2);
+    // Make sure every stage can be exec'd before starting any of them
+    for (int i = 0; i < inputs_num; i++) {
+        if (array_of_inputs[i][0] == NULL) {
+            fprintf(stderr, "%serror%s: empty command in pipeline\n", colors[ERR_COLOR], color_reset);
+            last_exit_status = 2;
+            return;
+        }
 
-    // Open each pipe
-    for (int i = 0; i < pipes_num; i++) {
-        if (pipe(pipes_fds[i]) == -1) {
-            fprintf(stderr, "%serror%s: pipe failed\n", colors[ERR_COLOR], color_reset);
+        if (!check_arg_max(array_of_inputs[i])) {
+            last_exit_status = 126;
             return;
         }
     }
 
     // An array that will contain the PID of each child process
-    int* pids = malloc(sizeof(int) * inputs_num);
+    pid_t* pids = arena_alloc(&line_arena, sizeof(pid_t) * inputs_num);
+
+    usage_begin(inputs_num, line_usage.precise);
 
-    // Fork and exec each input
+    // When profiling, every pipe is relayed through the shell
+    PipeProfile* profile = pipeline_profiling ? profile_begin(inputs_num) : NULL;
+
+    // The CPUs stages are pinned to, if they are
+    int cpus_num;
+    int* cpus = pipeline_cpu_order(&cpus_num);
+
+    // Read end of the pipe coming from the previous stage
+    int prev_read = -1;
+
+    // Exit status of a last stage that ran without a process
+    int last_stage_status = -1;
+
+    // Spawn each input, connected to its neighbours. Pipes are close-on-exec,
+    // so a child only keeps the ends it gets as stdin and stdout
     for (int i = 0; i < inputs_num; i++) {
-        pids[i] = fork();
+        long long stage_start = trace_begin();
 
-        if (pids[i] == -1) {
-            fprintf(stderr, "%serror%s: fork failed\n", colors[ERR_COLOR], color_reset);
-            return;
-        }
+        SpawnRequest request;
+        spawn_request_init(&request, array_of_inputs[i]);
 
-        // Child process
-        if (pids[i] == 0) {
+        request.fds[STDIN_FILENO] = prev_read;
+        prev_read = -1;
 
-            // Write to the first pipe only if it's the first input in the chain
-            if (i == 0) {
-                dup2(pipes_fds[0][PWRITE], STDOUT_FILENO);
+        if (i != inputs_num - 1 && profile != NULL) {
+            if (!profile_link_open(profile, i, &request.fds[STDOUT_FILENO], &prev_read)) {
+                fprintf(stderr, "%serror%s: pipe failed\n", colors[ERR_COLOR], color_reset);
+                close_request_fds(&request);
+                inputs_num = i;
+                last_exit_status = 1;
+                break;
             }
-            // Read from last pipe only if it's the last input in the chain
-            else if (i == inputs_num - 1) {
-                dup2(pipes_fds[pipes_num - 1][PREAD], STDIN_FILENO);
+        }
+        else if (i != inputs_num - 1) {
+            int pipe_fds[2];
+
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                fprintf(stderr, "%serror%s: pipe failed\n", colors[ERR_COLOR], color_reset);
+                close_request_fds(&request);
+                inputs_num = i;
+                last_exit_status = 1;
+                break;
             }
-            // If otherwise, read from the previous pipe, and write to the next pipe
-            else {
-                dup2(pipes_fds[i - 1][PREAD], STDIN_FILENO);
-                dup2(pipes_fds[i][PWRITE], STDOUT_FILENO);
+
+            pipeline_tune_pipe(pipe_fds[PWRITE]);
+
+            request.fds[STDOUT_FILENO] = pipe_fds[PWRITE];
+            prev_read = pipe_fds[PREAD];
+        }
+
+        // Explicit redirections take precedence over the pipes
+        Builtin* builtin = find_builtin(array_of_inputs[i][0]);
+
+        if (builtin != NULL) {
+            pids[i] = -1;
+
+            if (!open_io_redirection(array_of_inputs[i], request.fds))
+                last_stage_status = 1;
+            else if (i == inputs_num - 1 && (builtin->flags & BUILTIN_STATELESS) && profile == NULL) {
+                // Nothing runs after the last stage, so it doesn't need a process of its own,
+                // unless the shell has pipes to relay meanwhile
+                usage_builtin_begin(i, array_of_inputs[i][0]);
+                last_stage_status = run_builtin(builtin, array_of_inputs[i], request.fds);
+                usage_builtin_end(i, last_stage_status);
             }
+            else {
+                pids[i] = fork_builtin(builtin, array_of_inputs[i], request.fds);
 
-            // Close all pipes since we don't need them after duplication
-            for (int j = 0; j < pipes_num; j++) {
-                close(pipes_fds[j][PREAD]);
-                close(pipes_fds[j][PWRITE]);
+                if (pids[i] == -1)
+                    fprintf(stderr, "%serror%s: fork failed\n", colors[ERR_COLOR], color_reset);
+                else {
+                    pipeline_pin_stage(pids[i], i, cpus, cpus_num);
+                    usage_spawned(i, array_of_inputs[i][0], pids[i]);
+                }
             }
 
-            execvp(array_of_inputs[i][0], array_of_inputs[i]);
+            close_request_fds(&request);
+            trace_end("stage", stage_start, pids[i], i, array_of_inputs[i][0]);
+            continue;
+        }
+
+        request.path = path_lookup(array_of_inputs[i][0]);
 
-            // execvp never returns if it failed, so this normaly won't execute
-            fprintf(stderr, "%serror%s: command '%s' not found\n", colors[ERR_COLOR], color_reset, array_of_inputs[i][0]);
-            exit(EXIT_FAILURE);
+        if (request.path == NULL) {
+            report_command_not_found(array_of_inputs[i][0]);
+            pids[i] = -1;
         }
+        else if (!open_io_redirection(array_of_inputs[i], request.fds))
+            pids[i] = -1;
+        else {
+            pids[i] = spawn_process(&request);
+
+            if (pids[i] == -1)
+                report_spawn_error(array_of_inputs[i][0]);
+            else {
+                pipeline_pin_stage(pids[i], i, cpus, cpus_num);
+                usage_spawned(i, array_of_inputs[i][0], pids[i]);
+            }
+        }
+
+        close_request_fds(&request);
+        trace_end("stage", stage_start, pids[i], i, array_of_inputs[i][0]);
     }
 
-    // Close all the parent's pipes, and free the file descriptors for each
-    for (int j = 0; j < pipes_num; j++) {
-        close(pipes_fds[j][PREAD]);
-        close(pipes_fds[j][PWRITE]);
+    report_startup_latency();
+
+    if (profile != NULL)
+        profile_relay(profile);
 
-        free(pipes_fds[j]);
+    // Wait for each process to terminate, the pipeline's status is the status of its last command
+    usage_wait(pids, inputs_num);
+
+    if (profile != NULL)
+        profile_print(profile);
+
+    if (inputs_num > 0 && line_usage.stages[inputs_num - 1].status != -1)
+        last_exit_status = line_usage.stages[inputs_num - 1].status;
+
+    if (last_stage_status != -1)
+        last_exit_status = last_stage_status;
+}
+
+long get_arg_max() {
+    /*
+     * Returns: The kernel's limit on the combined size of the arguments and environment of an exec
+     */
+
+    static long arg_max = 0;
+
+    if (arg_max == 0) {
+        arg_max = sysconf(_SC_ARG_MAX);
+        if (arg_max <= 0)
+            arg_max = 131072;
     }
 
-    // Wait for each process to terminate
-    for (int i = 0; i < inputs_num; i++) {
-        if (pids[i] != -1)
-            waitpid(pids[i], NULL, 0);
+    return arg_max;
+}
+
+long get_arg_strlen_max() {
+    /*
+     * Returns: The longest a single argument can be, Linux caps every string at 32 pages (MAX_ARG_STRLEN)
+     */
+
+    return sysconf(_SC_PAGESIZE) * 32;
+}
+
+int check_arg_max(char** input) {
+    /*
+     * Checks that an argument vector, together with the environment, fits in the kernel's ARG_MAX
+     *
+     * Arguments:
+     *  input: A null terminated array of char pointers (strings)
+     *
+     * Returns: 1 if the command can be exec'd, 0 after printing an error otherwise
+     */
+
+    long arg_max = get_arg_max();
+    long arg_strlen_max = get_arg_strlen_max();
+
+    size_t size = argv_size(input) + argv_size(environ);
+
+    if (size > (size_t) arg_max) {
+        fprintf(stderr, "%serror%s: argument list too long (%zu bytes, the limit is %ld)\n",
+                colors[ERR_COLOR], color_reset, size, arg_max);
+        return 0;
     }
 
-    free(pipes_fds);
-    free(pids);
+    for (int i = 0; input[i] != NULL; i++) {
+        if (strlen(input[i]) >= (size_t) arg_strlen_max) {
+            fprintf(stderr, "%serror%s: argument %d is too long (the limit is %ld bytes)\n",
+                    colors[ERR_COLOR], color_reset, i, arg_strlen_max);
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
-void redirect_io(char* filename, int io_type, int append_flag) {
+int open_redirect_file(char* filename, int io_type, int append_flag) {
     /*
-     * Redirects the specified I/O to the specified file
+     * Opens the file an I/O stream gets redirected to
      *
      * Arguments:
      *  filename: The file to which the I/O will be redirected
      *  io_type: The type of I/O to be redirected (STDOUT_FILENO, STDERR_FILENO, STDIN_FILENO)
      *  append_flag: Specifies whether to overwrite the file or append to it
+     *
+     * Returns: A close-on-exec file descriptor, or -1 after printing an error
      */
 
-    FILE* io_file;
-    char* mode;
+    int flags;
 
-    // If we redirect stdout or stderr we do a write
-    if (io_type == STDOUT_FILENO || io_type == STDERR_FILENO) {
-        if (append_flag)
-            mode = "a";
-        else
-            mode = "w";
-    }
-    // Otherwise for stdin we do a read
-    else if (io_type == STDIN_FILENO) {
-        mode = "r";
-    }
+    // If we redirect stdout or stderr we do a write, otherwise for stdin we do a read
+    if (io_type == STDIN_FILENO)
+        flags = O_RDONLY;
+    else if (append_flag)
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    else
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
 
-    io_file = fopen(filename, mode);
+    int fd = open(filename, flags | O_CLOEXEC, 0666);
 
-    if (io_file == NULL) {
-        fprintf(stderr, "%serror%s: I/O redirection failed\n", colors[ERR_COLOR], color_reset);
-        exit(EXIT_FAILURE);
-    }
+    if (fd == -1)
+        fprintf(stderr, "%serror%s: I/O redirection failed: %s: %s\n", colors[ERR_COLOR], color_reset, filename, strerror(errno));
 
-    // Perform the actual redirection
-    dup2(fileno(io_file), io_type);
-    fclose(io_file);
+    return fd;
 }
 
-int handle_io_redirection(char** input) {
+int open_io_redirection(char** input, int fds[3]) {
     /*
-     * Searches for the I/O redirection operators ('>', '>>', '<')
-     * and performs the according redirection
+     * Searches for the I/O redirection operators ('>', '>>', '<'), opens the according files
+     * and cuts the operators off the input
      *
      * Arguments:
      *  input: A null terminated array of char pointers (strings)
+     *  fds: The descriptors for stdin, stdout and stderr. Replaced ones get closed
      *
-     * Returns: The index at which the operator is found. Returns -1 if none is found
+     * Returns: 1 on success, 0 after printing an error otherwise
      */
 
-    // Initial arbitrary values to compare against in the end
-    int io_type = 42;
-    int append_flag = 42;
+    long long span = trace_begin();
+    int first_operator = -1;
 
-    int i = 0;
-    while (input[i] != NULL) {
+    for (int i = 0; input[i] != NULL; i++) {
+        int io_type, append_flag = 0;
 
-        if (strcmp(input[i], ">") == 0) {
+        if (is_operator(input[i], TOK_GREAT))
             io_type = STDOUT_FILENO;
-            append_flag = 0;
-            break;
-        }
-        else if (strcmp(input[i], ">>") == 0) {
+        else if (is_operator(input[i], TOK_DGREAT)) {
             io_type = STDOUT_FILENO;
             append_flag = 1;
-            break;
         }
-        else if (strcmp(input[i], "<") == 0) {
+        else if (is_operator(input[i], TOK_LESS))
             io_type = STDIN_FILENO;
-            append_flag = 0;
-            break;
-        }
-        i++;
-    }
+        else
+            continue;
 
-    // If both the initial values changed then an operator was found
-    if (io_type != 42 && append_flag != 42) {
-        if (input[i + 1] == NULL) {
+        if (input[i + 1] == NULL || is_redirection_operator(input[i + 1])) {
             fprintf(stderr, "%serror%s: I/O redirection file unspecified\n", colors[ERR_COLOR], color_reset);
-            exit(EXIT_FAILURE);
+            return 0;
         }
-        else {
-            redirect_io(input[i + 1], io_type, append_flag);
-            return i;
-        }
-    }
 
-    return -1;
-}
+        int fd = open_redirect_file(input[i + 1], io_type, append_flag);
+        if (fd == -1)
+            return 0;
 
-void sigchld_handler(int sig, siginfo_t *info, void *context) {
-    /*
-     * SIGCHLD handler that prints the pid of the background process that terminates
-     */
+        // Drop whatever the stream was going to get, unless another stream still uses it
+        int old_fd = fds[io_type];
+        fds[io_type] = fd;
+
+        if (old_fd != -1 && old_fd != fds[0] && old_fd != fds[1] && old_fd != fds[2])
+            close(old_fd);
 
-    sigchld_flag = info->si_pid;
+        if (first_operator == -1)
+            first_operator = i;
 
-    // Disable signal handler
-    struct sigaction sa;
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = (void*) SIG_DFL;
-    sigemptyset(&sa.sa_mask);
+        i++;
+    }
+
+    // Only commands that actually redirect something get a span
+    if (first_operator != -1) {
+        input[first_operator] = NULL;
+        trace_end("redirect", span, -1, -1, NULL);
+    }
+
+    return 1;
+}
 
-    sigaction(SIGCHLD, &sa, NULL);
+int is_redirection_operator(char* word) {
+    return is_operator(word, TOK_GREAT) || is_operator(word, TOK_DGREAT) || is_operator(word, TOK_LESS);
 }
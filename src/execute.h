@@ -1,13 +1,28 @@
 #ifndef EXECUTE_H
 #define EXECUTE_H
 
+#include <signal.h>
+
+#include "spawn.h"
+#include "builtins.h"
+
+int execute_line(char* line);
+int exit_status(int wait_status);
 void execute_input(char** input);
-int execute_builtin(char** input);
+int run_builtin(Builtin* builtin, char** input, int fds[3]);
+pid_t fork_builtin(Builtin* builtin, char** input, int fds[3]);
 void execute_piped_inputs(char*** array_of_inputs);
+long get_arg_max();
+long get_arg_strlen_max();
+int check_arg_max(char** input);
 
-void redirect_io(char* filename, int io_type, int append_flag);
-int handle_io_redirection(char** input);
+void queue_background_job(char** input, Builtin* builtin, char* path, int fds[3]);
+void report_spawn_error(char* command);
+void report_command_not_found(char* command);
+void close_request_fds(SpawnRequest* request);
 
-void sigchld_handler(int sig, siginfo_t *info, void *context);
+int open_redirect_file(char* filename, int io_type, int append_flag);
+int open_io_redirection(char** input, int fds[3]);
+int is_redirection_operator(char* word);
 
 #endif
@@ -0,0 +1,537 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "glob.h"
+#include "arena.h"
+#include "argvec.h"
+
+#include "globals.h"
+
+// The record layout getdents64 fills the buffer with
+struct linux_dirent64 {
+    ino_t d_ino;
+    off_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Called for every entry of a scanned directory. The name is only valid during the call
+typedef void (*EntryVisitor)(const char* name, unsigned char type, void* context);
+
+// The state of expanding a single word
+typedef struct GlobState {
+    char** components;
+    int components_num;
+    int trailing_slash;
+
+    char path[PATH_MAX];
+    GlobNames matches;
+} GlobState;
+
+// What a visitor matches entries against, and where it puts the ones it keeps
+typedef struct GlobVisit {
+    const char* pattern;
+    int hidden;
+    GlobNames* names;
+    GlobState* state;
+    size_t path_len;
+} GlobVisit;
+
+// Directory listings read during the current command line, in line_arena
+static GlobListing* listings = NULL;
+
+// Kept between lines, entries are read into it in large batches
+static char* dents_buffer = NULL;
+
+void glob_begin_line() {
+    /*
+     * Forgets the directory listings of the previous command line, whose memory went
+     * away with line_arena, so every line sees the filesystem as it is when it's run
+     */
+
+    listings = NULL;
+}
+
+static void names_push(GlobNames* names, char* name, unsigned char type) {
+    /*
+     * Appends a name to a list, doubling its capacity when it's full
+     */
+
+    if (names->length == names->capacity) {
+        size_t capacity = names->capacity == 0 ? 64 : names->capacity * 2;
+
+        char** items = arena_alloc(&line_arena, sizeof(char*) * capacity);
+        unsigned char* types = arena_alloc(&line_arena, capacity);
+
+        if (names->length > 0) {
+            memcpy(items, names->names, sizeof(char*) * names->length);
+            memcpy(types, names->types, names->length);
+        }
+
+        names->names = items;
+        names->types = types;
+        names->capacity = capacity;
+    }
+
+    names->names[names->length] = name;
+    names->types[names->length] = type;
+    names->length++;
+}
+
+static int match_bracket(const char* pattern, char c, const char** end) {
+    /*
+     * Matches a character against a bracket expression like [a-z], [!0-9] or []abc]
+     *
+     * Arguments:
+     *  pattern: Points to the opening '['
+     *  c: The character to match
+     *  end: Set to just past the closing ']'
+     *
+     * Returns: 1 if it matches, 0 if it doesn't, and -1 if the bracket is never closed,
+     *          in which case the '[' is an ordinary character
+     */
+
+    const char* p = pattern + 1;
+    int negate = 0;
+    int matched = 0;
+
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+
+    // A ']' right at the start is part of the set
+    int first = 1;
+
+    while (*p != ']' || first) {
+        first = 0;
+
+        if (*p == '\0')
+            return -1;
+
+        char low = *p;
+        if (low == '\\' && p[1] != '\0')
+            low = *++p;
+        p++;
+
+        char high = low;
+        if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+            p++;
+            high = *p;
+            if (high == '\\' && p[1] != '\0')
+                high = *++p;
+            p++;
+        }
+
+        if ((unsigned char)c >= (unsigned char)low && (unsigned char)c <= (unsigned char)high)
+            matched = 1;
+    }
+
+    *end = p + 1;
+
+    return matched ^ negate;
+}
+
+static int glob_match(const char* pattern, const char* name) {
+    /*
+     * Matches a name against a single path component of a pattern. Stars are matched by
+     * backtracking to the most recent one only, which keeps it linear in practice and
+     * never exponential
+     *
+     * Returns: 1 if the whole name matches, 0 if it doesn't
+     */
+
+    const char* p = pattern;
+    const char* star_pattern = NULL;
+    const char* star_name = NULL;
+
+    while (*name != '\0') {
+        if (*p == '*') {
+            star_pattern = ++p;
+            star_name = name;
+            continue;
+        }
+
+        int matched = 0;
+        const char* next = p + 1;
+
+        if (*p == '?')
+            matched = 1;
+        else if (*p == '[' && (matched = match_bracket(p, *name, &next)) >= 0)
+            ;
+        else if (*p == '\\' && p[1] != '\0') {
+            matched = p[1] == *name;
+            next = p + 2;
+        }
+        else
+            matched = *p != '\0' && *p == *name;
+
+        if (matched == 1) {
+            p = next;
+            name++;
+        }
+        else if (star_pattern != NULL) {
+            // Let the last star swallow one more character and try again
+            p = star_pattern;
+            name = ++star_name;
+        }
+        else
+            return 0;
+    }
+
+    while (*p == '*')
+        p++;
+
+    return *p == '\0';
+}
+
+static int is_wild(const char* component) {
+    /*
+     * Returns: Whether a pattern component has any unescaped pattern characters
+     */
+
+    for (const char* c = component; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0')
+            c++;
+        else if (*c == '*' || *c == '?' || *c == '[')
+            return 1;
+    }
+
+    return 0;
+}
+
+static size_t append_path(char* path, size_t path_len, const char* name, int unescape) {
+    /*
+     * Appends a component to a path, with a slash in between if it needs one
+     *
+     * Returns: The new length of the path, or 0 if it would be longer than PATH_MAX
+     */
+
+    size_t len = path_len;
+
+    if (len > 0 && path[len - 1] != '/')
+        path[len++] = '/';
+
+    for (const char* c = name; *c != '\0'; c++) {
+        if (unescape && *c == '\\' && c[1] != '\0')
+            c++;
+
+        if (len + 1 >= PATH_MAX)
+            return 0;
+
+        path[len++] = *c;
+    }
+
+    path[len] = '\0';
+
+    return len;
+}
+
+static void scan_directory(const char* path, EntryVisitor visit, void* context) {
+    /*
+     * Calls a visitor for every entry of a directory other than "." and "..". The entries
+     * are read straight from the kernel with getdents64 into a large buffer, so a
+     * directory with millions of entries takes a few hundred syscalls and no stat() calls.
+     * Listings are cached for the rest of the command line unless they're huge, in which
+     * case they're streamed again every time rather than held in memory
+     *
+     * Arguments:
+     *  path: The directory, or an empty string for the current directory
+     *  visit: Called with each entry's name and d_type, which may be DT_UNKNOWN
+     *  context: Passed along to the visitor
+     */
+
+    for (GlobListing* listing = listings; listing != NULL; listing = listing->next) {
+        if (strcmp(listing->path, path) == 0) {
+            for (size_t i = 0; i < listing->entries.length; i++)
+                visit(listing->entries.names[i], listing->entries.types[i], context);
+
+            return;
+        }
+    }
+
+    int fd = open(path[0] == '\0' ? "." : path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    if (dents_buffer == NULL) {
+        dents_buffer = malloc(GLOB_DENTS_BUFFER_SIZE);
+
+        if (dents_buffer == NULL) {
+            fprintf(stderr, "%serror%s: out of memory\n", colors[ERR_COLOR], color_reset);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    GlobListing* listing = arena_alloc(&line_arena, sizeof(GlobListing));
+    memset(listing, 0, sizeof(GlobListing));
+
+    int caching = 1;
+    long nread;
+
+    while ((nread = syscall(SYS_getdents64, fd, dents_buffer, GLOB_DENTS_BUFFER_SIZE)) > 0) {
+        for (long offset = 0; offset < nread;) {
+            struct linux_dirent64* entry = (struct linux_dirent64*)(dents_buffer + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            if (caching) {
+                if (listing->entries.length == GLOB_CACHE_MAX_ENTRIES)
+                    caching = 0;
+                else {
+                    name = arena_strdup(&line_arena, name);
+                    names_push(&listing->entries, (char*)name, entry->d_type);
+                }
+            }
+
+            visit(name, entry->d_type, context);
+        }
+    }
+
+    close(fd);
+
+    if (caching && nread == 0) {
+        listing->path = arena_strdup(&line_arena, path);
+        listing->next = listings;
+        listings = listing;
+    }
+}
+
+static void visit_match(const char* name, unsigned char type, void* context) {
+    /*
+     * Keeps the entries whose name matches the pattern component, as whole paths
+     * if they're the last component, or as bare names to descend into if they aren't
+     */
+
+    GlobVisit* visit = context;
+
+    if (name[0] == '.' && !visit->hidden)
+        return;
+
+    if (!glob_match(visit->pattern, name))
+        return;
+
+    if (visit->names == &visit->state->matches) {
+        char* path = visit->state->path;
+        size_t len = append_path(path, visit->path_len, name, 0);
+
+        if (len != 0)
+            names_push(visit->names, arena_strndup(&line_arena, path, len), type);
+
+        path[visit->path_len] = '\0';
+    }
+    // Only directories, or what might turn out to be one, can have more components under them
+    else if (type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN)
+        names_push(visit->names, arena_strdup(&line_arena, name), type);
+}
+
+static void visit_subdirectory(const char* name, unsigned char type, void* context) {
+    /*
+     * Keeps the entries a "**" descends into: directories that aren't hidden and aren't
+     * symlinks, so a link cycle can't make it loop forever
+     */
+
+    GlobVisit* visit = context;
+
+    if (name[0] == '.')
+        return;
+
+    if (type == DT_UNKNOWN) {
+        char* path = visit->state->path;
+        size_t len = append_path(path, visit->path_len, name, 0);
+
+        struct stat st;
+        if (len != 0 && fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+            type = DT_DIR;
+
+        path[visit->path_len] = '\0';
+    }
+
+    if (type == DT_DIR)
+        names_push(visit->names, arena_strdup(&line_arena, name), type);
+}
+
+static void expand(GlobState* state, size_t path_len, int component, int verified) {
+    /*
+     * Expands the pattern from one component onwards, below the path built so far
+     *
+     * Arguments:
+     *  state: The word being expanded, whose path holds the directories matched so far
+     *  path_len: The length of the path matched so far
+     *  component: The index of the next component to match
+     *  verified: Whether the path is known to exist, as a directory if it has to be one
+     */
+
+    char* path = state->path;
+
+    if (component == state->components_num) {
+        // Literal components are only checked once, at the very end
+        if (!verified) {
+            struct stat st;
+            const char* file = path_len == 0 ? "." : path;
+
+            if (state->trailing_slash) {
+                if (stat(file, &st) == -1 || !S_ISDIR(st.st_mode))
+                    return;
+            }
+            else if (fstatat(AT_FDCWD, file, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                return;
+        }
+
+        size_t len = path_len;
+        if (state->trailing_slash && (len == 0 || path[len - 1] != '/'))
+            len = append_path(path, path_len, "", 0);
+
+        if (len != 0)
+            names_push(&state->matches, arena_strndup(&line_arena, path, len), DT_UNKNOWN);
+
+        path[path_len] = '\0';
+        return;
+    }
+
+    const char* pattern = state->components[component];
+
+    // A literal component is taken as is, without reading the directory it's in
+    if (!is_wild(pattern)) {
+        size_t len = append_path(path, path_len, pattern, 1);
+
+        if (len != 0)
+            expand(state, len, component + 1, 0);
+
+        path[path_len] = '\0';
+        return;
+    }
+
+    GlobNames names = {0};
+    GlobVisit visit = {
+        .pattern = pattern,
+        .hidden = pattern[0] == '.' || (pattern[0] == '\\' && pattern[1] == '.'),
+        .names = &names,
+        .state = state,
+        .path_len = path_len,
+    };
+
+    if (strcmp(pattern, "**") == 0) {
+        // Matching zero directories first
+        expand(state, path_len, component + 1, verified);
+
+        scan_directory(path, visit_subdirectory, &visit);
+
+        for (size_t i = 0; i < names.length; i++) {
+            size_t len = append_path(path, path_len, names.names[i], 0);
+
+            if (len != 0)
+                expand(state, len, component, 1);
+
+            path[path_len] = '\0';
+        }
+
+        return;
+    }
+
+    // The last component's matches are final, so they're gathered while the directory is read
+    if (component == state->components_num - 1 && !state->trailing_slash) {
+        visit.names = &state->matches;
+        scan_directory(path, visit_match, &visit);
+        return;
+    }
+
+    scan_directory(path, visit_match, &visit);
+
+    // A directory that's been read is no longer in the way of the ones below it
+    for (size_t i = 0; i < names.length; i++) {
+        size_t len = append_path(path, path_len, names.names[i], 0);
+
+        // Symlinks and unknown types are checked by trying to open them as a directory
+        if (len != 0)
+            expand(state, len, component + 1, names.types[i] == DT_DIR);
+
+        path[path_len] = '\0';
+    }
+}
+
+void glob_unescape(char* pattern) {
+    /*
+     * Turns a pattern that matched nothing back into the word it was typed as, by
+     * removing the backslashes that escape its quoted characters
+     */
+
+    char* out = pattern;
+
+    for (char* c = pattern; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0')
+            c++;
+
+        *out++ = *c;
+    }
+
+    *out = '\0';
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int glob_expand(const char* pattern, ArgVector* out) {
+    /*
+     * Expands a glob pattern into the paths it matches. Supports *, ?, [...] and ** for
+     * any number of directories. Names starting with a dot are only matched by a pattern
+     * component that starts with one too
+     *
+     * Arguments:
+     *  pattern: The pattern, where a backslash makes the next character literal
+     *  out: The sorted matches are appended to this
+     *
+     * Returns: The number of matches, which are allocated from line_arena
+     */
+
+    size_t length = strlen(pattern);
+    if (length >= PATH_MAX)
+        return 0;
+
+    GlobState* state = arena_alloc(&line_arena, sizeof(GlobState));
+    memset(state, 0, sizeof(GlobState));
+
+    // Split the pattern into its components, which is at most one for every other character
+    char* copy = arena_strndup(&line_arena, pattern, length);
+    state->components = arena_alloc(&line_arena, sizeof(char*) * (length / 2 + 2));
+
+    size_t path_len = 0;
+    if (copy[0] == '/') {
+        state->path[0] = '/';
+        state->path[1] = '\0';
+        path_len = 1;
+    }
+
+    for (char* component = strtok(copy, "/"); component != NULL; component = strtok(NULL, "/"))
+        state->components[state->components_num++] = component;
+
+    state->trailing_slash = length > 1 && pattern[length - 1] == '/';
+
+    // A "**" at the end matches everything below it
+    if (state->components_num > 0 && strcmp(state->components[state->components_num - 1], "**") == 0)
+        state->components[state->components_num++] = "*";
+
+    expand(state, path_len, 0, 1);
+
+    qsort(state->matches.names, state->matches.length, sizeof(char*), compare_paths);
+
+    for (size_t i = 0; i < state->matches.length; i++)
+        argvec_push(out, state->matches.names[i]);
+
+    return state->matches.length;
+}
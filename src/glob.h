@@ -0,0 +1,33 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <stddef.h>
+
+#include "argvec.h"
+
+// The size of the buffer directory entries are read into, many at a time
+#define GLOB_DENTS_BUFFER_SIZE (256 * 1024)
+
+// Directories with more entries than this are streamed every time instead of being cached
+#define GLOB_CACHE_MAX_ENTRIES 65536
+
+// A growable list of directory entry names with their d_type, allocated from line_arena
+typedef struct GlobNames {
+    char** names;
+    unsigned char* types;
+    size_t length;
+    size_t capacity;
+} GlobNames;
+
+// The entries of a directory, read once per command line
+typedef struct GlobListing {
+    char* path;
+    GlobNames entries;
+    struct GlobListing* next;
+} GlobListing;
+
+void glob_begin_line();
+int glob_expand(const char* pattern, ArgVector* out);
+void glob_unescape(char* pattern);
+
+#endif
@@ -2,6 +2,7 @@
 #define GLOBALS_H
 
 #include "main.h"
+#include "arena.h"
 
 #define RED     0
 #define GREEN   1
@@ -13,10 +14,14 @@
 #define PID_COLOR BLUE
 #define ERR_COLOR RED
 
-extern BgProcess bg_processes[];
+// Per command line allocator, reset after each line is executed
+extern Arena line_arena;
 
-// Flag set by the SIGCHLD signal handler. contains the terminated child pid
-extern int sigchld_flag;
+// Exit status of the last executed command line
+extern int last_exit_status;
+
+// Set when commands aren't read interactively
+extern int batch_mode;
 
 // Global constants for the username and hostname
 extern char* username;
@@ -0,0 +1,757 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <poll.h>
+
+#include <readline/readline.h>
+
+#include "histindex.h"
+#include "history.h"
+#include "pathcache.h"
+
+#include "globals.h"
+
+static HistIndex history_index;
+
+static uint64_t char_bit(unsigned char c) {
+    return 1ULL << (tolower(c) % 64);
+}
+
+static int table_bucket(StringTable* table, const char* key) {
+    /*
+     * Returns: The bucket holding key, or the empty one it would go in
+     */
+
+    int mask = table->capacity - 1;
+    int bucket = hash_string(key) & mask;
+
+    while (table->keys[bucket] != NULL && strcmp(table->keys[bucket], key) != 0)
+        bucket = (bucket + 1) & mask;
+
+    return bucket;
+}
+
+static void table_put(StringTable* table, const char* key, int value);
+
+static void table_grow(StringTable* table) {
+    StringTable old = *table;
+
+    table->capacity = old.capacity ? old.capacity * 2 : HISTINDEX_INITIAL_CAPACITY;
+    table->keys = calloc(table->capacity, sizeof(char*));
+    table->values = malloc(table->capacity * sizeof(int));
+    table->used = 0;
+
+    for (int i = 0; i < old.capacity; i++) {
+        if (old.keys[i] != NULL)
+            table_put(table, old.keys[i], old.values[i]);
+    }
+
+    free(old.keys);
+    free(old.values);
+}
+
+static void table_put(StringTable* table, const char* key, int value) {
+    if ((table->used + 1) * 10 > table->capacity * 7)
+        table_grow(table);
+
+    int bucket = table_bucket(table, key);
+
+    if (table->keys[bucket] == NULL)
+        table->used++;
+
+    table->keys[bucket] = key;
+    table->values[bucket] = value;
+}
+
+static int table_get(StringTable* table, const char* key, const char** interned) {
+    /*
+     * Returns: The value of key, -1 if it isn't there. interned, if given, is set to the stored key
+     */
+
+    if (table->capacity == 0)
+        return -1;
+
+    int bucket = table_bucket(table, key);
+
+    if (table->keys[bucket] == NULL)
+        return -1;
+
+    if (interned != NULL)
+        *interned = table->keys[bucket];
+
+    return table->values[bucket];
+}
+
+static uint32_t trigram_at(const char* str) {
+    return (tolower((unsigned char) str[0]) << 16) | (tolower((unsigned char) str[1]) << 8) | tolower((unsigned char) str[2]);
+}
+
+static Posting* find_posting(uint32_t trigram) {
+    if (history_index.postings_capacity == 0)
+        return NULL;
+
+    // Multiplicative hashing puts the entropy in the high bits, fold them down
+    uint32_t hash = trigram * 2654435761U;
+    int mask = history_index.postings_capacity - 1;
+    int bucket = (hash ^ (hash >> 16)) & mask;
+
+    while (history_index.postings[bucket].trigram != 0) {
+        if (history_index.postings[bucket].trigram == trigram)
+            return &history_index.postings[bucket];
+
+        bucket = (bucket + 1) & mask;
+    }
+
+    return &history_index.postings[bucket];
+}
+
+static void grow_postings() {
+    Posting* old = history_index.postings;
+    int old_capacity = history_index.postings_capacity;
+
+    history_index.postings_capacity = old_capacity ? old_capacity * 2 : HISTINDEX_INITIAL_CAPACITY;
+    history_index.postings = calloc(history_index.postings_capacity, sizeof(Posting));
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (old[i].trigram != 0)
+            *find_posting(old[i].trigram) = old[i];
+    }
+
+    free(old);
+}
+
+static void index_trigrams(const char* command, int group) {
+    size_t length = strlen(command);
+
+    for (size_t i = 0; i + 3 <= length; i++) {
+        uint32_t trigram = trigram_at(command + i);
+
+        if (history_index.postings_used * 2 >= history_index.postings_capacity)
+            grow_postings();
+
+        Posting* posting = find_posting(trigram);
+
+        if (posting->trigram == 0) {
+            posting->trigram = trigram;
+            history_index.postings_used++;
+        }
+
+        // A command repeating a trigram is listed once
+        if (posting->length > 0 && posting->ids[posting->length - 1] == group)
+            continue;
+
+        if (posting->length == posting->capacity) {
+            posting->capacity = posting->capacity ? posting->capacity * 2 : 4;
+            posting->ids = realloc(posting->ids, posting->capacity * sizeof(int));
+        }
+
+        posting->ids[posting->length++] = group;
+    }
+}
+
+static int add_group(const char* command) {
+    if (history_index.groups_length == history_index.groups_capacity) {
+        history_index.groups_capacity = history_index.groups_capacity ? history_index.groups_capacity * 2 : HISTINDEX_INITIAL_CAPACITY;
+        history_index.groups = realloc(history_index.groups, history_index.groups_capacity * sizeof(HistGroup));
+    }
+
+    int id = history_index.groups_length++;
+    HistGroup* group = &history_index.groups[id];
+
+    group->command = arena_strdup(&history_index.strings, command);
+    group->chars = 0;
+    group->first_char = tolower((unsigned char) command[0]);
+    group->count = 0;
+    group->last_time = 0;
+    group->first_place = -1;
+
+    for (const char* c = command; *c; c++)
+        group->chars |= char_bit(*c);
+
+    table_put(&history_index.commands, group->command, id);
+    index_trigrams(command, id);
+
+    return id;
+}
+
+static int add_place(int group, const char* cwd) {
+    if (history_index.places_length == history_index.places_capacity) {
+        history_index.places_capacity = history_index.places_capacity ? history_index.places_capacity * 2 : HISTINDEX_INITIAL_CAPACITY;
+        history_index.places = realloc(history_index.places, history_index.places_capacity * sizeof(HistPlace));
+    }
+
+    int id = history_index.places_length++;
+    HistPlace* place = &history_index.places[id];
+
+    place->group = group;
+    place->cwd = cwd;
+    place->count = 0;
+    place->last_time = 0;
+    place->last_status = 0;
+    place->next = history_index.groups[group].first_place;
+
+    history_index.groups[group].first_place = id;
+
+    return id;
+}
+
+static int* find_place(int group, const char* cwd) {
+    /*
+     * Returns: The bucket of the place of group in cwd, holding -1 if there's none yet
+     */
+
+    if (history_index.place_buckets_capacity == 0) {
+        history_index.place_buckets_capacity = HISTINDEX_INITIAL_CAPACITY;
+        history_index.place_buckets = malloc(HISTINDEX_INITIAL_CAPACITY * sizeof(int));
+        memset(history_index.place_buckets, -1, HISTINDEX_INITIAL_CAPACITY * sizeof(int));
+    }
+
+    uint64_t hash = ((uint64_t) group * 0x9e3779b97f4a7c15ULL) ^ (uintptr_t) cwd;
+    hash ^= hash >> 29;
+
+    int mask = history_index.place_buckets_capacity - 1;
+    int bucket = hash & mask;
+
+    while (history_index.place_buckets[bucket] != -1) {
+        HistPlace* place = &history_index.places[history_index.place_buckets[bucket]];
+
+        if (place->group == group && place->cwd == cwd)
+            break;
+
+        bucket = (bucket + 1) & mask;
+    }
+
+    return &history_index.place_buckets[bucket];
+}
+
+static void grow_place_buckets() {
+    free(history_index.place_buckets);
+
+    history_index.place_buckets_capacity *= 2;
+    history_index.place_buckets = malloc(history_index.place_buckets_capacity * sizeof(int));
+    memset(history_index.place_buckets, -1, history_index.place_buckets_capacity * sizeof(int));
+
+    for (int i = 0; i < history_index.places_length; i++)
+        *find_place(history_index.places[i].group, history_index.places[i].cwd) = i;
+}
+
+static void index_record(const HistoryRecord* record) {
+    const char* command = history_command(record);
+
+    if (*command == '\0')
+        return;
+
+    int group = table_get(&history_index.commands, command, NULL);
+    if (group == -1)
+        group = add_group(command);
+
+    // Directories are interned, so places compare them by pointer
+    const char* cwd;
+    if (table_get(&history_index.cwds, history_cwd(record), &cwd) == -1) {
+        cwd = arena_strdup(&history_index.strings, history_cwd(record));
+        table_put(&history_index.cwds, cwd, 0);
+    }
+
+    int* bucket = find_place(group, cwd);
+    int id = *bucket;
+
+    if (id == -1) {
+        id = *bucket = add_place(group, cwd);
+
+        if (history_index.places_length * 2 > history_index.place_buckets_capacity)
+            grow_place_buckets();
+    }
+
+    HistGroup* entry = &history_index.groups[group];
+    HistPlace* place = &history_index.places[id];
+
+    entry->count += record->count;
+    place->count += record->count;
+
+    if (record->time >= place->last_time) {
+        place->last_time = record->time;
+        place->last_status = record->status;
+    }
+
+    if (record->time > entry->last_time)
+        entry->last_time = record->time;
+}
+
+void histindex_update() {
+    /*
+     * Indexes the history entries added since the last call, the whole file the first time
+     */
+
+    history_sync();
+
+    const HistoryRecord* record;
+
+    while ((record = history_next(&history_store.indexed)) != NULL)
+        index_record(record);
+}
+
+int histindex_idle() {
+    /*
+     * Indexes a slice of the history, so the first search doesn't have to index it all.
+     * Called by the interactive loop while it has nothing else to do
+     *
+     * Returns: 1 if there's more left to index, 0 otherwise
+     */
+
+    const HistoryRecord* record;
+
+    for (int i = 0; i < HISTINDEX_IDLE_SLICE; i++) {
+        if ((record = history_next(&history_store.indexed)) == NULL)
+            return 0;
+
+        index_record(record);
+    }
+
+    return 1;
+}
+
+static double frecency(uint32_t count, int64_t last_time, time_t now) {
+    /*
+     * Ranks commands run often and recently above the rest
+     */
+
+    int64_t age = now - last_time;
+    double weight;
+
+    if (age < 3600)
+        weight = 4;
+    else if (age < 86400)
+        weight = 2;
+    else if (age < 604800)
+        weight = 1;
+    else
+        weight = 0.5;
+
+    return count * weight;
+}
+
+static double fuzzy_match(const char* command, const char* query) {
+    /*
+     * Matches the query's characters in order, ignoring case
+     *
+     * Returns: 0 if they're not all there, otherwise a bonus between 1 and 3 that is higher
+     *          the closer together they are and if they start at the beginning
+     */
+
+    const char* first = NULL;
+    const char* last = NULL;
+    const char* q = query;
+
+    for (const char* c = command; *c && *q; c++) {
+        if (tolower((unsigned char) *c) == tolower((unsigned char) *q)) {
+            if (first == NULL)
+                first = c;
+
+            last = c;
+            q++;
+        }
+    }
+
+    if (*q != '\0')
+        return 0;
+
+    if (first == NULL)
+        return 1;
+
+    double bonus = 1 + (double) strlen(query) / (last - first + 1);
+
+    if (first == command)
+        bonus += 1;
+
+    return bonus;
+}
+
+static void push_result(HistResult* results, int* length, int max_results, HistResult result) {
+    /*
+     * Keeps the best max_results results in a min heap on their score
+     */
+
+    if (*length < max_results) {
+        int i = (*length)++;
+        results[i] = result;
+
+        while (i > 0 && results[(i - 1) / 2].score > results[i].score) {
+            HistResult swap = results[i];
+            results[i] = results[(i - 1) / 2];
+            results[(i - 1) / 2] = swap;
+            i = (i - 1) / 2;
+        }
+
+        return;
+    }
+
+    if (result.score <= results[0].score)
+        return;
+
+    results[0] = result;
+
+    int i = 0;
+    while (1) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+
+        if (left < *length && results[left].score < results[smallest].score)
+            smallest = left;
+        if (right < *length && results[right].score < results[smallest].score)
+            smallest = right;
+        if (smallest == i)
+            break;
+
+        HistResult swap = results[i];
+        results[i] = results[smallest];
+        results[smallest] = swap;
+        i = smallest;
+    }
+}
+
+static int compare_results(const void* a, const void* b) {
+    double diff = ((const HistResult*) b)->score - ((const HistResult*) a)->score;
+    return (diff > 0) - (diff < 0);
+}
+
+static int seek(const Posting* posting, int* cursor, int id) {
+    /*
+     * Moves a cursor walking a posting list from its end down to the first id not above id.
+     * Candidates come in descending order, so every list is walked once in all
+     *
+     * Returns: 1 if the list contains id
+     */
+
+    int i = *cursor;
+
+    // Gallop down, then binary search the last step
+    int step = 1;
+    while (i - step >= 0 && posting->ids[i - step] > id)
+        step *= 2;
+
+    int low = (i - step >= 0) ? i - step : 0;
+    int high = i;
+
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+
+        if (posting->ids[mid] > id)
+            high = mid - 1;
+        else
+            low = mid;
+    }
+
+    *cursor = low;
+
+    return posting->ids[low] == id;
+}
+
+static double place_score(const HistGroup* group, const char* cwd, int status, time_t now, int* best_place) {
+    /*
+     * Returns: The score of the best of a command's places that passes the filters, -1 if none does
+     */
+
+    double best = -1;
+
+    for (int p = group->first_place; p != -1; p = history_index.places[p].next) {
+        HistPlace* place = &history_index.places[p];
+
+        if ((cwd != NULL && place->cwd != cwd) || (status != -1 && place->last_status != status))
+            continue;
+
+        double score = frecency(place->count, place->last_time, now);
+        if (score > best) {
+            best = score;
+            *best_place = p;
+        }
+    }
+
+    return best;
+}
+
+int histindex_search(const char* query, int options, int status, HistResult* results, int max_results) {
+    /*
+     * Searches the history for commands containing query, best first. Substring queries
+     * of three characters or more only look at the commands sharing all of its trigrams,
+     * fuzzy ones at the commands containing all of its characters. A command is only read
+     * once its frecency shows it could make it into the results
+     *
+     * Arguments:
+     *  query: What to look for, ignoring case. Empty matches everything
+     *  options: SEARCH_FUZZY and SEARCH_CWD
+     *  status: Only commands that last exited with this status, -1 for any
+     *  results: Filled with up to max_results results
+     *
+     * Returns: The number of results
+     */
+
+    histindex_update();
+
+    if (max_results <= 0)
+        return 0;
+
+    time_t now = time(NULL);
+    int length = 0;
+    size_t query_length = strlen(query);
+    int fuzzy = options & SEARCH_FUZZY;
+
+    const char* cwd = NULL;
+    if (options & SEARCH_CWD) {
+        char path[PATH_MAX];
+
+        if (getcwd(path, sizeof(path)) == NULL || table_get(&history_index.cwds, path, &cwd) == -1)
+            return 0;
+    }
+
+    // The commands to look at, all of them unless the trigrams narrow it down
+    const int* candidates = NULL;
+    int candidates_length = history_index.groups_length;
+
+    Posting* postings[64];
+    int cursors[64];
+    int postings_length = 0;
+
+    if (!fuzzy && query_length >= 3) {
+        for (size_t i = 0; i + 3 <= query_length && postings_length < 64; i++) {
+            Posting* posting = find_posting(trigram_at(query + i));
+
+            if (posting == NULL || posting->trigram == 0)
+                return 0;
+
+            postings[postings_length++] = posting;
+        }
+
+        // Walk the rarest trigram, checking the others as we go
+        for (int i = 1; i < postings_length; i++) {
+            if (postings[i]->length < postings[0]->length) {
+                Posting* swap = postings[0];
+                postings[0] = postings[i];
+                postings[i] = swap;
+            }
+        }
+
+        for (int i = 0; i < postings_length; i++)
+            cursors[i] = postings[i]->length - 1;
+
+        candidates = postings[0]->ids;
+        candidates_length = postings[0]->length;
+    }
+
+    uint64_t query_chars = 0;
+    for (const char* c = query; *c; c++)
+        query_chars |= char_bit(*c);
+
+    // Fuzzy matches get up to 3 times their frecency, commands starting with the query twice
+    int first_char = tolower((unsigned char) query[0]);
+    double max_fuzzy_bonus = 3;
+
+    // Newest first, so of two commands with the same score the newer one is kept
+    for (int i = candidates_length - 1; i >= 0; i--) {
+        int id = candidates ? candidates[i] : i;
+
+        if (candidates != NULL) {
+            int found = 1;
+            for (int j = 1; j < postings_length && found; j++)
+                found = seek(postings[j], &cursors[j], id);
+
+            if (!found)
+                continue;
+        }
+
+        HistGroup* group = &history_index.groups[id];
+
+        if ((group->chars & query_chars) != query_chars)
+            continue;
+
+        HistResult result = { id, -1, 0 };
+        double score;
+
+        if (cwd != NULL || status != -1)
+            score = place_score(group, cwd, status, now, &result.place);
+        else
+            score = frecency(group->count, group->last_time, now);
+
+        if (score < 0)
+            continue;
+
+        double bound = score;
+        if (fuzzy)
+            bound *= max_fuzzy_bonus;
+        else if (query_length > 0 && group->first_char == first_char)
+            bound *= 2;
+
+        if (length == max_results && bound <= results[0].score)
+            continue;
+
+        // Only now is the command itself read
+        double bonus = 1;
+
+        if (fuzzy) {
+            bonus = fuzzy_match(group->command, query);
+            if (bonus == 0)
+                continue;
+        }
+        else if (query_length > 3 || (candidates == NULL && query_length > 0)) {
+            if (strcasestr(group->command, query) == NULL)
+                continue;
+        }
+
+        if (!fuzzy && query_length > 0 && group->first_char == first_char
+                && strncasecmp(group->command, query, query_length) == 0)
+            bonus *= 2;
+
+        result.score = score * bonus;
+        push_result(results, &length, max_results, result);
+    }
+
+    qsort(results, length, sizeof(HistResult), compare_results);
+
+    return length;
+}
+
+const char* histindex_command(const HistResult* result) {
+    return history_index.groups[result->group].command;
+}
+
+const HistPlace* histindex_place(const HistResult* result) {
+    /*
+     * Returns: The place that matched the filters, or else the one the command last ran in
+     */
+
+    if (result->place != -1)
+        return &history_index.places[result->place];
+
+    const HistPlace* latest = NULL;
+
+    for (int p = history_index.groups[result->group].first_place; p != -1; p = history_index.places[p].next) {
+        if (latest == NULL || history_index.places[p].last_time > latest->last_time)
+            latest = &history_index.places[p];
+    }
+
+    return latest;
+}
+
+static int read_escape_sequence() {
+    /*
+     * Tells a lone Esc from the start of an arrow key, by whether more input follows right away
+     *
+     * Returns: The arrow's letter ('A' to 'D'), or 0 for Esc
+     */
+
+    struct pollfd poll_fd = { fileno(rl_instream), POLLIN, 0 };
+
+    if (poll(&poll_fd, 1, 20) <= 0)
+        return 0;
+
+    int c = rl_read_key();
+    if (c != '[' && c != 'O')
+        return 0;
+
+    return rl_read_key();
+}
+
+static int search_widget(int count, int key) {
+    /*
+     * Replaces readline's reverse-i-search. Type to search, Ctrl + R and Ctrl + S (or the
+     * arrows) move between results, Ctrl + T toggles fuzzy matching, Ctrl + O shows only
+     * the commands run in this directory. Enter runs the result, Tab or Right edits it,
+     * Esc or Ctrl + G goes back to the line as it was
+     */
+
+    char* saved_line = strdup(rl_line_buffer);
+    int saved_point = rl_point;
+
+    char query[256] = "";
+    size_t query_length = 0;
+    int options = 0;
+    int selected = 0;
+
+    HistResult results[HISTINDEX_MAX_RESULTS];
+    int results_length = 0;
+    int accept = 0, done = 0;
+
+    while (!done) {
+        results_length = histindex_search(query, options, -1, results, HISTINDEX_MAX_RESULTS);
+
+        if (selected >= results_length)
+            selected = results_length ? results_length - 1 : 0;
+
+        const char* where = "";
+        if (results_length > 0)
+            where = histindex_place(&results[selected])->cwd;
+
+        rl_message("(%s%s %d/%d %s)`%s': ", (options & SEARCH_FUZZY) ? "fuzzy" : "search",
+                (options & SEARCH_CWD) ? " here" : "", results_length ? selected + 1 : 0, results_length, where, query);
+
+        rl_replace_line(results_length ? histindex_command(&results[selected]) : "", 0);
+        rl_point = rl_end;
+        rl_redisplay();
+
+        int c = rl_read_key();
+        int arrow = 0;
+
+        if (c == '\033') {
+            arrow = read_escape_sequence();
+
+            if (arrow == 0) {
+                done = 1;
+                continue;
+            }
+        }
+
+        if (c == ('R' & 0x1f) || arrow == 'B')
+            selected++;
+        else if (c == ('S' & 0x1f) || arrow == 'A')
+            selected = selected > 0 ? selected - 1 : 0;
+        else if (c == ('T' & 0x1f))
+            options ^= SEARCH_FUZZY;
+        else if (c == ('O' & 0x1f))
+            options ^= SEARCH_CWD;
+        else if (c == ('G' & 0x1f) || c == EOF)
+            done = 1;
+        else if (c == '\r' || c == '\n')
+            accept = done = 2;
+        else if (c == '\t' || arrow == 'C' || arrow == 'D')
+            accept = done = 1;
+        else if ((c == 127 || c == '\b') && query_length > 0) {
+            query[--query_length] = '\0';
+            selected = 0;
+        }
+        else if ((c >= ' ' && c != 127) && query_length < sizeof(query) - 1) {
+            query[query_length++] = c;
+            query[query_length] = '\0';
+            selected = 0;
+        }
+    }
+
+    rl_clear_message();
+
+    // The keys that end the search leave the query and the results as they were
+    if (accept && selected < results_length) {
+        rl_replace_line(histindex_command(&results[selected]), 0);
+        rl_point = rl_end;
+    }
+    else {
+        rl_replace_line(saved_line, 0);
+        rl_point = saved_point;
+        accept = 0;
+    }
+
+    free(saved_line);
+
+    if (accept == 2)
+        return rl_newline(1, '\n');
+
+    rl_redisplay();
+
+    return 0;
+}
+
+void histindex_bind_keys() {
+    rl_bind_keyseq("\\C-r", search_widget);
+}
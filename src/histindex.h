@@ -0,0 +1,93 @@
+#ifndef HISTINDEX_H
+#define HISTINDEX_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "arena.h"
+
+#define HISTINDEX_INITIAL_CAPACITY 1024
+#define HISTINDEX_MAX_RESULTS      100
+
+// Records indexed at a time while the shell is idle, a few milliseconds worth
+#define HISTINDEX_IDLE_SLICE       4096
+
+// Search options
+#define SEARCH_FUZZY    1   // the query's characters in order, not necessarily together
+#define SEARCH_CWD      2   // only commands run in the current directory
+
+// A distinct command, with every directory it was run in
+typedef struct HistGroup {
+    char* command;
+    uint64_t chars;         // bit set of the (lowercased) characters it contains, for fuzzy search
+    int first_char;         // lowercased, commands starting with the query rank higher
+    uint32_t count;
+    int64_t last_time;
+    int first_place;        // its places, linked through HistPlace.next
+} HistGroup;
+
+// A command in one directory
+typedef struct HistPlace {
+    int group;
+    const char* cwd;
+    uint32_t count;
+    int64_t last_time;
+    int32_t last_status;
+    int next;               // next place of the same group, -1 at the end
+} HistPlace;
+
+// Group ids containing one trigram, ascending
+typedef struct Posting {
+    uint32_t trigram;       // 0 marks an empty bucket
+    int* ids;
+    int length;
+    int capacity;
+} Posting;
+
+// Interned strings, mapping to an id
+typedef struct StringTable {
+    const char** keys;
+    int* values;
+    int capacity;
+    int used;
+} StringTable;
+
+typedef struct HistIndex {
+    Arena strings;
+
+    HistGroup* groups;
+    int groups_length;
+    int groups_capacity;
+
+    HistPlace* places;
+    int places_length;
+    int places_capacity;
+
+    // Open addressing hash from a group and a directory to their place
+    int* place_buckets;
+    int place_buckets_capacity;
+
+    StringTable commands;   // command to group id
+    StringTable cwds;       // interned directories
+
+    Posting* postings;
+    int postings_capacity;
+    int postings_used;
+} HistIndex;
+
+typedef struct HistResult {
+    int group;
+    int place;              // with SEARCH_CWD or a status filter, the place that matched. -1 otherwise
+    double score;
+} HistResult;
+
+void histindex_update();
+int histindex_idle();
+int histindex_search(const char* query, int options, int status, HistResult* results, int max_results);
+
+const char* histindex_command(const HistResult* result);
+const HistPlace* histindex_place(const HistResult* result);
+
+void histindex_bind_keys();
+
+#endif
@@ -0,0 +1,619 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <readline/history.h>
+
+#include "history.h"
+#include "pathcache.h"
+
+#include "globals.h"
+
+#define RECORD_ALIGN 8
+#define ALIGN(n) (((n) + RECORD_ALIGN - 1) & ~((size_t) RECORD_ALIGN - 1))
+
+HistoryStore history_store = { .fd = -1 };
+
+const char* history_command(const HistoryRecord* record) {
+    return (const char*) (record + 1);
+}
+
+const char* history_cwd(const HistoryRecord* record) {
+    return history_command(record) + record->command_length + 1;
+}
+
+static const HistoryRecord* record_at(const char* map, size_t size, size_t offset) {
+    /*
+     * Returns: The record at offset if it is whole and consistent, NULL otherwise
+     */
+
+    if (offset % RECORD_ALIGN != 0 || offset + sizeof(HistoryRecord) + sizeof(uint32_t) > size)
+        return NULL;
+
+    const HistoryRecord* record = (const HistoryRecord*) (map + offset);
+
+    if (record->magic != HISTORY_RECORD_MAGIC || record->length > size - offset)
+        return NULL;
+
+    size_t needed = sizeof(HistoryRecord) + (size_t) record->command_length + record->cwd_length + 2 + sizeof(uint32_t);
+
+    if (record->length % RECORD_ALIGN != 0 || record->length < needed)
+        return NULL;
+
+    uint32_t trailer;
+    memcpy(&trailer, map + offset + record->length - sizeof(trailer), sizeof(trailer));
+
+    if (trailer != record->length)
+        return NULL;
+
+    // Both strings must be terminated where they say
+    const char* command = history_command(record);
+    if (command[record->command_length] != '\0' || command[record->command_length + record->cwd_length + 1] != '\0')
+        return NULL;
+
+    return record;
+}
+
+static const HistoryRecord* next_record(const char* map, size_t size, size_t* offset) {
+    /*
+     * Returns the first whole record at or after *offset, and moves *offset past it.
+     * A record torn by a crash is skipped by looking for the next one that is whole
+     *
+     * Returns: The record, or NULL once there are none left
+     */
+
+    if (*offset < sizeof(HistoryHeader))
+        *offset = sizeof(HistoryHeader);
+
+    for (size_t at = *offset; at + sizeof(HistoryRecord) <= size; at += RECORD_ALIGN) {
+        const HistoryRecord* record = record_at(map, size, at);
+
+        if (record != NULL) {
+            *offset = at + record->length;
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+static const HistoryRecord* prev_record(const char* map, size_t size, size_t* offset) {
+    /*
+     * Returns the record ending at *offset, and moves *offset to its start.
+     * Only when that one is torn does it fall back to reading from the start
+     *
+     * Returns: The record, or NULL once there are none left
+     */
+
+    if (*offset <= sizeof(HistoryHeader) || *offset > size)
+        return NULL;
+
+    uint32_t length;
+    memcpy(&length, map + *offset - sizeof(length), sizeof(length));
+
+    if (length <= *offset - sizeof(HistoryHeader)) {
+        const HistoryRecord* record = record_at(map, size, *offset - length);
+
+        if (record != NULL) {
+            *offset -= length;
+            return record;
+        }
+    }
+
+    size_t at = 0, last = 0;
+    const HistoryRecord* found = NULL;
+    const HistoryRecord* record;
+
+    while ((record = next_record(map, *offset, &at)) != NULL) {
+        found = record;
+        last = at - record->length;
+    }
+
+    if (found != NULL)
+        *offset = last;
+
+    return found;
+}
+
+const HistoryRecord* history_next(size_t* offset) {
+    /*
+     * Walks the history file from the oldest entry, starting with *offset at 0
+     */
+
+    if (history_store.map == NULL)
+        return NULL;
+
+    return next_record(history_store.map, history_store.map_size, offset);
+}
+
+const HistoryRecord* history_prev(size_t* offset) {
+    /*
+     * Walks the history file from the newest entry, starting with *offset at history_store.map_size
+     */
+
+    if (history_store.map == NULL)
+        return NULL;
+
+    return prev_record(history_store.map, history_store.map_size, offset);
+}
+
+static void unmap_store() {
+    if (history_store.map != NULL)
+        munmap((void*) history_store.map, history_store.map_size);
+
+    history_store.map = NULL;
+    history_store.map_size = 0;
+}
+
+static int map_store(size_t size) {
+    /*
+     * Maps the first size bytes of the history file, if it grew since it was last mapped
+     */
+
+    if (size == history_store.map_size && history_store.map != NULL)
+        return 1;
+
+    unmap_store();
+
+    if (size < sizeof(HistoryHeader))
+        return 0;
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_store.fd, 0);
+    if (map == MAP_FAILED)
+        return 0;
+
+    history_store.map = map;
+    history_store.map_size = size;
+
+    return 1;
+}
+
+static int open_store() {
+    /*
+     * Opens the history file, creating it with its header if it's missing
+     *
+     * Returns: 1 on success, 0 if there's no usable history file
+     */
+
+    int fd = open(history_store.path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return 0;
+
+    struct stat info;
+    flock(fd, LOCK_EX);
+
+    if (fstat(fd, &info) == -1) {
+        close(fd);
+        return 0;
+    }
+
+    if (info.st_size == 0) {
+        HistoryHeader header = { HISTORY_MAGIC, 0, 0, 0 };
+
+        if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+            flock(fd, LOCK_UN);
+            close(fd);
+            return 0;
+        }
+    }
+    else {
+        HistoryHeader header;
+
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, HISTORY_MAGIC, 8) != 0) {
+            fprintf(stderr, "%serror%s: %s is not a cash history file\n", colors[ERR_COLOR], color_reset, history_store.path);
+            flock(fd, LOCK_UN);
+            close(fd);
+            return 0;
+        }
+    }
+
+    flock(fd, LOCK_UN);
+
+    history_store.fd = fd;
+    history_store.inode = info.st_ino;
+
+    return 1;
+}
+
+static size_t translate_offset(const HistoryHeader* header, size_t offset) {
+    /*
+     * Returns: Where an offset in the file a compaction started from is in the compacted file.
+     *          Records that were merged into older ones are skipped
+     */
+
+    if (header->source_size == 0)
+        return sizeof(HistoryHeader);
+    else if (offset >= header->source_size)
+        return header->compacted_size + (offset - header->source_size);
+    else
+        return header->compacted_size;
+}
+
+static void reopen_store() {
+    /*
+     * Follows the history file to the new one a compaction put in its place. The records
+     * appended while it ran were copied at the end as they were, so what was already seen
+     * of them is found again through the header
+     */
+
+    unmap_store();
+    close(history_store.fd);
+    history_store.fd = -1;
+
+    if (!open_store())
+        return;
+
+    HistoryHeader header;
+
+    if (pread(history_store.fd, &header, sizeof(header), 0) != sizeof(header))
+        memset(&header, 0, sizeof(header));
+
+    history_store.seen = translate_offset(&header, history_store.seen);
+    history_store.indexed = translate_offset(&header, history_store.indexed);
+}
+
+static int store_replaced() {
+    struct stat info;
+
+    return stat(history_store.path, &info) == 0 && info.st_ino != history_store.inode;
+}
+
+static void* compact_main(void* arg);
+
+static void start_compaction() {
+    // Like every helper thread, it leaves the signals to the main thread
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+
+    pthread_t compactor;
+    if (pthread_create(&compactor, NULL, compact_main, strdup(history_store.path)) == 0)
+        pthread_detach(compactor);
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+void history_init() {
+    /*
+     * Opens the history file ($CASH_HISTFILE, or ~/.cash_history) and hands the most recent
+     * entries to readline. It is read from the end, so this takes the same time however
+     * long the history is. Compacts the file in the background when it has grown enough
+     */
+
+    char* path = getenv("CASH_HISTFILE");
+
+    if (path != NULL)
+        history_store.path = strdup(path);
+    else {
+        char* home = getenv("HOME");
+        if (home == NULL)
+            return;
+
+        history_store.path = malloc(strlen(home) + strlen(HISTORY_FILE_NAME) + 2);
+        sprintf(history_store.path, "%s/%s", home, HISTORY_FILE_NAME);
+    }
+
+    if (!open_store())
+        return;
+
+    struct stat info;
+    if (fstat(history_store.fd, &info) == -1 || !map_store(info.st_size))
+        return;
+
+    // Find where the recent entries start, then add them oldest first
+    size_t offset = history_store.map_size;
+
+    for (int i = 0; i < HISTORY_RECENT && history_prev(&offset) != NULL; i++)
+        ;
+
+    const HistoryRecord* record;
+
+    while ((record = history_next(&offset)) != NULL)
+        add_history(history_command(record));
+
+    history_store.seen = history_store.map_size;
+
+    const HistoryHeader* header = (const HistoryHeader*) history_store.map;
+
+    if (history_store.map_size >= HISTORY_COMPACT_MIN_SIZE && history_store.map_size >= 2 * header->compacted_size)
+        start_compaction();
+}
+
+void history_add(const char* line, int status) {
+    /*
+     * Adds a line to readline's history and appends it to the history file, with the time,
+     * the working directory and its exit status. Sessions append to the same file, each
+     * record with a single write, and pick up each other's entries in history_sync()
+     */
+
+    add_history(line);
+
+    if (history_store.fd == -1)
+        return;
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        cwd[0] = '\0';
+
+    size_t command_length = strlen(line);
+    size_t cwd_length = strlen(cwd);
+    size_t length = ALIGN(sizeof(HistoryRecord) + command_length + cwd_length + 2 + sizeof(uint32_t));
+
+    if (length > UINT32_MAX)
+        return;
+
+    char* buffer = calloc(1, length);
+    HistoryRecord* record = (HistoryRecord*) buffer;
+
+    record->magic = HISTORY_RECORD_MAGIC;
+    record->length = length;
+    record->time = time(NULL);
+    record->status = status;
+    record->command_length = command_length;
+    record->cwd_length = cwd_length;
+    record->pid = getpid();
+    record->count = 1;
+
+    memcpy(buffer + sizeof(HistoryRecord), line, command_length);
+    memcpy(buffer + sizeof(HistoryRecord) + command_length + 1, cwd, cwd_length);
+
+    uint32_t trailer = length;
+    memcpy(buffer + length - sizeof(trailer), &trailer, sizeof(trailer));
+
+    // A compaction takes the lock exclusively while it swaps the file out
+    flock(history_store.fd, LOCK_SH);
+
+    if (store_replaced()) {
+        flock(history_store.fd, LOCK_UN);
+        reopen_store();
+
+        if (history_store.fd == -1) {
+            free(buffer);
+            return;
+        }
+
+        flock(history_store.fd, LOCK_SH);
+    }
+
+    if (write(history_store.fd, buffer, length) != (ssize_t) length)
+        fprintf(stderr, "%serror%s: couldn't write to %s\n", colors[ERR_COLOR], color_reset, history_store.path);
+
+    flock(history_store.fd, LOCK_UN);
+
+    free(buffer);
+}
+
+void history_sync() {
+    /*
+     * Hands readline the entries other sessions added since the last call
+     */
+
+    if (history_store.fd == -1)
+        return;
+
+    if (store_replaced())
+        reopen_store();
+
+    struct stat info;
+    if (history_store.fd == -1 || fstat(history_store.fd, &info) == -1 || (size_t) info.st_size <= history_store.seen)
+        return;
+
+    if (!map_store(info.st_size))
+        return;
+
+    size_t offset = history_store.seen;
+    const HistoryRecord* record;
+    pid_t pid = getpid();
+
+    while ((record = history_next(&offset)) != NULL) {
+        // Ours were added as they ran
+        if (record->pid != (uint32_t) pid)
+            add_history(history_command(record));
+
+        history_store.seen = offset;
+    }
+}
+
+static unsigned long record_hash(const HistoryRecord* record) {
+    return hash_string(history_command(record)) * 31 + hash_string(history_cwd(record));
+}
+
+static int same_entry(const HistoryRecord* a, const HistoryRecord* b) {
+    return a->command_length == b->command_length && a->cwd_length == b->cwd_length
+        && memcmp(history_command(a), history_command(b), a->command_length + a->cwd_length + 2) == 0;
+}
+
+static int write_all(int fd, const void* buffer, size_t size) {
+    const char* data = buffer;
+
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+
+        data += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+static void* compact_main(void* arg) {
+    /*
+     * Rewrites the history file without duplicate entries, one record standing for all runs
+     * of a command in a directory, at the place of the newest one. Torn records are dropped.
+     * The file is only locked at the end, to copy what other sessions appended meanwhile and
+     * swap the new file in
+     */
+
+    char* path = arg;
+    char* temp_path = malloc(strlen(path) + sizeof(".compact"));
+    sprintf(temp_path, "%s.compact", path);
+
+    const char* map = MAP_FAILED;
+    size_t size = 0;
+    size_t* offsets = NULL;
+    uint32_t* counts = NULL;
+    long* table = NULL;
+    char* out = NULL;
+
+    int source_fd = open(path, O_RDONLY | O_CLOEXEC);
+    int temp_fd = open(temp_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    // Another session is on it
+    if (source_fd == -1 || temp_fd == -1 || flock(temp_fd, LOCK_EX | LOCK_NB) == -1)
+        goto done;
+
+    struct stat info;
+    if (fstat(source_fd, &info) == -1 || (size_t) info.st_size < sizeof(HistoryHeader))
+        goto done;
+
+    size = info.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, source_fd, 0);
+    if (map == MAP_FAILED)
+        goto done;
+
+    size_t records = 0, capacity = 1024;
+    offsets = malloc(capacity * sizeof(size_t));
+
+    size_t offset = 0;
+    const HistoryRecord* record;
+
+    while ((record = next_record(map, size, &offset)) != NULL) {
+        if (records == capacity) {
+            capacity *= 2;
+            offsets = realloc(offsets, capacity * sizeof(size_t));
+        }
+
+        offsets[records++] = offset - record->length;
+    }
+
+    // Newest first, so the first record of an entry is the one kept, and the older ones
+    // are counted into it. Kept records have their index in the table, others a count of 0
+    size_t table_size = 16;
+    while (table_size < records * 2)
+        table_size *= 2;
+
+    table = malloc(table_size * sizeof(long));
+    for (size_t i = 0; i < table_size; i++)
+        table[i] = -1;
+
+    counts = calloc(records ? records : 1, sizeof(uint32_t));
+
+    for (size_t i = records; i-- > 0;) {
+        record = (const HistoryRecord*) (map + offsets[i]);
+        size_t bucket = record_hash(record) & (table_size - 1);
+
+        while (table[bucket] != -1) {
+            const HistoryRecord* kept = (const HistoryRecord*) (map + offsets[table[bucket]]);
+
+            if (same_entry(kept, record))
+                break;
+
+            bucket = (bucket + 1) & (table_size - 1);
+        }
+
+        if (table[bucket] == -1) {
+            table[bucket] = i;
+            counts[i] = record->count;
+        }
+        else
+            counts[table[bucket]] += record->count;
+    }
+
+    if (ftruncate(temp_fd, 0) == -1 || lseek(temp_fd, sizeof(HistoryHeader), SEEK_SET) == -1)
+        goto done;
+
+    // Written in large chunks rather than a record at a time
+    size_t out_capacity = 1 << 20, out_length = 0;
+    out = malloc(out_capacity);
+
+    for (size_t i = 0; i < records; i++) {
+        if (counts[i] == 0)
+            continue;
+
+        record = (const HistoryRecord*) (map + offsets[i]);
+
+        if (out_length + record->length > out_capacity) {
+            if (!write_all(temp_fd, out, out_length))
+                goto done;
+
+            out_length = 0;
+
+            if (record->length > out_capacity) {
+                out_capacity = record->length;
+                out = realloc(out, out_capacity);
+            }
+        }
+
+        memcpy(out + out_length, record, record->length);
+        ((HistoryRecord*) (out + out_length))->count = counts[i];
+        out_length += record->length;
+    }
+
+    if (!write_all(temp_fd, out, out_length))
+        goto done;
+
+    off_t compacted_size = lseek(temp_fd, 0, SEEK_CUR);
+
+    // Hold off appends while the rest is copied and the file is swapped
+    flock(source_fd, LOCK_EX);
+
+    struct stat current;
+    if (stat(path, &current) == -1 || current.st_ino != info.st_ino || fstat(source_fd, &info) == -1) {
+        flock(source_fd, LOCK_UN);
+        goto done;
+    }
+
+    off_t tail = size;
+    int copied = 1;
+
+    while (tail < info.st_size) {
+        ssize_t n = copy_file_range(source_fd, &tail, temp_fd, NULL, info.st_size - tail, 0);
+
+        if (n <= 0) {
+            copied = 0;
+            break;
+        }
+    }
+
+    HistoryHeader header = { HISTORY_MAGIC, size, compacted_size, 0 };
+
+    if (copied && pwrite(temp_fd, &header, sizeof(header), 0) == sizeof(header) && fsync(temp_fd) == 0)
+        rename(temp_path, path);
+
+    flock(source_fd, LOCK_UN);
+
+done:
+    if (map != MAP_FAILED)
+        munmap((void*) map, size);
+    if (source_fd != -1)
+        close(source_fd);
+    if (temp_fd != -1)
+        close(temp_fd);
+
+    free(offsets);
+    free(counts);
+    free(table);
+    free(out);
+    free(temp_path);
+    free(path);
+
+    return NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HISTORY_FILE_NAME       ".cash_history"
+#define HISTORY_MAGIC           "CASHHIS1"
+#define HISTORY_RECORD_MAGIC    0x48534163  // "cASH" on little endian
+
+// Entries handed to readline at startup, older ones are only read from the file when searched
+#define HISTORY_RECENT          1000
+
+// Listed by the history builtin
+#define HISTORY_LIST_DEFAULT    25
+
+// Compact once the file is this big, and twice as big as it was after the last compaction
+#define HISTORY_COMPACT_MIN_SIZE (1 << 20)
+
+// At the start of the file
+typedef struct HistoryHeader {
+    char magic[8];
+    uint64_t source_size;       // size of the file it was compacted from, 0 if it never was
+    uint64_t compacted_size;    // where the records appended during the compaction start
+    uint64_t reserved;
+} HistoryHeader;
+
+// Records are appended with a single write each, 8 byte aligned. The command and the
+// working directory follow the header as strings, and the length is repeated at the end
+// so the file can be read backwards
+typedef struct HistoryRecord {
+    uint32_t magic;
+    uint32_t length;            // of the whole record, trailing length included
+    int64_t time;
+    int32_t status;
+    uint32_t command_length;
+    uint32_t cwd_length;
+    uint32_t pid;               // of the session that ran it
+    uint32_t count;             // runs it stands for, compaction merges duplicates
+    uint32_t reserved;
+} HistoryRecord;
+
+// The history file of this session, mapped read only
+typedef struct HistoryStore {
+    char* path;
+    int fd;                     // -1 if there's no history file
+    ino_t inode;
+
+    const char* map;
+    size_t map_size;
+
+    size_t seen;                // offset up to which records were handed to readline
+    size_t indexed;             // offset up to which records were indexed for searching
+} HistoryStore;
+
+extern HistoryStore history_store;
+
+void history_init();
+void history_add(const char* line, int status);
+void history_sync();
+
+const HistoryRecord* history_next(size_t* offset);
+const HistoryRecord* history_prev(size_t* offset);
+
+const char* history_command(const HistoryRecord* record);
+const char* history_cwd(const HistoryRecord* record);
+
+#endif
@@ -0,0 +1,683 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "execute.h"
+#include "spawn.h"
+#include "builtins.h"
+#include "loop.h"
+#include "usage.h"
+#include "brace.h"
+
+#include "globals.h"
+
+#define PID_EMPTY    0
+#define PID_DELETED -1
+
+JobTable job_table;
+
+// Set by the SIGCHLD handler, tells the shell there are children to reap
+volatile sig_atomic_t sigchld_pending = 0;
+
+static const char* state_names[] = {
+    [JOB_QUEUED]  = "queued",
+    [JOB_RUNNING] = "running",
+    [JOB_STOPPED] = "stopped",
+    [JOB_DONE]    = "done",
+};
+
+void sigchld_handler(int sig) {
+    sigchld_pending = 1;
+}
+
+void jobs_init() {
+    /*
+     * Sets up the job table, and the SIGCHLD handler that stays installed for the shell's lifetime
+     */
+
+    memset(&job_table, 0, sizeof(job_table));
+
+    struct sigaction sa;
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+static unsigned int pid_bucket(pid_t pid, int capacity) {
+    return ((unsigned int) pid * 2654435761u) & (capacity - 1);
+}
+
+static void pid_insert(pid_t pid, int id);
+
+static void pid_rehash(int capacity) {
+    /*
+     * Rebuilds the pid index with the given power of two capacity, dropping deleted buckets
+     */
+
+    pid_t* old_keys = job_table.pid_keys;
+    int* old_values = job_table.pid_values;
+    int old_capacity = job_table.pid_capacity;
+
+    job_table.pid_keys = calloc(capacity, sizeof(pid_t));
+    job_table.pid_values = calloc(capacity, sizeof(int));
+    job_table.pid_capacity = capacity;
+    job_table.pid_used = 0;
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (old_keys[i] != PID_EMPTY && old_keys[i] != PID_DELETED)
+            pid_insert(old_keys[i], old_values[i]);
+    }
+
+    free(old_keys);
+    free(old_values);
+}
+
+static void pid_insert(pid_t pid, int id) {
+    // Keep the load factor, deleted buckets included, under 1/2
+    if ((job_table.pid_used + 1) * 2 > job_table.pid_capacity) {
+        int capacity = (job_table.pid_capacity == 0) ? JOBS_INITIAL_CAPACITY * 2 : job_table.pid_capacity;
+
+        while ((job_table.count + 1) * 4 > capacity)
+            capacity *= 2;
+
+        pid_rehash(capacity);
+    }
+
+    unsigned int b = pid_bucket(pid, job_table.pid_capacity);
+
+    while (job_table.pid_keys[b] != PID_EMPTY && job_table.pid_keys[b] != PID_DELETED)
+        b = (b + 1) & (job_table.pid_capacity - 1);
+
+    if (job_table.pid_keys[b] == PID_EMPTY)
+        job_table.pid_used++;
+
+    job_table.pid_keys[b] = pid;
+    job_table.pid_values[b] = id;
+}
+
+static int pid_find(pid_t pid) {
+    /*
+     * Returns: The bucket holding pid, or -1
+     */
+
+    if (job_table.pid_capacity == 0)
+        return -1;
+
+    unsigned int b = pid_bucket(pid, job_table.pid_capacity);
+
+    while (job_table.pid_keys[b] != PID_EMPTY) {
+        if (job_table.pid_keys[b] == pid)
+            return b;
+
+        b = (b + 1) & (job_table.pid_capacity - 1);
+    }
+
+    return -1;
+}
+
+static char* join_argv(char** argv) {
+    size_t len = 1;
+    for (int i = 0; argv[i] != NULL; i++)
+        len += strlen(argv[i]) + 1;
+
+    char* command = malloc(len);
+    char* end = command;
+
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (i > 0)
+            *end++ = ' ';
+
+        size_t n = strlen(argv[i]);
+        memcpy(end, argv[i], n);
+        end += n;
+    }
+
+    *end = '\0';
+
+    return command;
+}
+
+static char** copy_argv(char** argv) {
+    /*
+     * Copies an argument vector into a single allocation, freed with free()
+     */
+
+    int argc = 0;
+    size_t length = 0;
+
+    for (; argv[argc] != NULL; argc++)
+        length += strlen(argv[argc]) + 1;
+
+    char** copy = malloc(sizeof(char*) * (argc + 1) + length);
+    char* strings = (char*)(copy + argc + 1);
+
+    for (int i = 0; i < argc; i++) {
+        copy[i] = strings;
+        strings = stpcpy(strings, argv[i]) + 1;
+    }
+
+    copy[argc] = NULL;
+
+    return copy;
+}
+
+static char** copy_deferred_patterns(char** argv) {
+    /*
+     * Deferred brace words are known by their address in line_arena, which is gone by the
+     * time a queued job starts, so their patterns are kept to parse them again
+     *
+     * Returns: The pattern of every deferred argument, by index, or NULL if there are none
+     */
+
+    int argc = 0;
+    int deferred = 0;
+
+    for (; argv[argc] != NULL; argc++) {
+        if (brace_lookup(argv[argc]) != NULL)
+            deferred = 1;
+    }
+
+    if (!deferred)
+        return NULL;
+
+    char** patterns = calloc(argc, sizeof(char*));
+
+    for (int i = 0; i < argc; i++) {
+        Brace* brace = brace_lookup(argv[i]);
+
+        if (brace != NULL)
+            patterns[i] = strdup(brace->pattern);
+    }
+
+    return patterns;
+}
+
+static pid_t fork_queued_builtin(Job* job, Builtin* builtin) {
+    /*
+     * Starts a queued builtin, with its deferred brace words parsed again for the child
+     *
+     * Returns: The child's pid, or -1 if it couldn't be forked
+     */
+
+    if (job->patterns == NULL)
+        return fork_builtin(builtin, job->argv, job->fds);
+
+    Arena arena = { 0 };
+    Brace* saved = brace_swap_deferred(NULL);
+
+    for (int i = 0; job->argv[i] != NULL; i++) {
+        Brace* brace = (job->patterns[i] != NULL) ? brace_parse(job->patterns[i], &arena) : NULL;
+
+        if (brace != NULL)
+            brace_defer(brace, job->argv[i]);
+    }
+
+    pid_t pid = fork_builtin(builtin, job->argv, job->fds);
+
+    brace_swap_deferred(saved);
+    arena_release(&arena);
+
+    return pid;
+}
+
+static Job* job_new(char** argv) {
+    /*
+     * Takes a free slot in the job table, or makes a new one
+     *
+     * Returns: The job, with everything but its pid and state filled in
+     */
+
+    int id;
+
+    if (job_table.free_head != 0) {
+        id = job_table.free_head;
+        job_table.free_head = job_table.jobs[id - 1].next;
+    }
+    else {
+        if (job_table.slots_used == job_table.capacity) {
+            job_table.capacity = (job_table.capacity == 0) ? JOBS_INITIAL_CAPACITY : job_table.capacity * 2;
+            job_table.jobs = realloc(job_table.jobs, sizeof(Job) * job_table.capacity);
+        }
+
+        job_table.slots_used++;
+        id = job_table.slots_used;
+    }
+
+    Job* job = &job_table.jobs[id - 1];
+    job->id = id;
+    job->pid = 0;
+    job->status = 0;
+    job->command = join_argv(argv);
+    job->next = 0;
+    job->pidfd = -1;
+    job->argv = NULL;
+    job->path = NULL;
+    job->builtin = 0;
+    job->patterns = NULL;
+    memset(&job->usage, 0, sizeof(job->usage));
+    clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+
+    job_table.count++;
+
+    return job;
+}
+
+static void job_started(Job* job, pid_t pid) {
+    job->pid = pid;
+    job->state = JOB_RUNNING;
+    job->pidfd = loop_watch_process(pid);
+    clock_gettime(CLOCK_MONOTONIC, &job->start_time);
+
+    job_table.running++;
+    pid_insert(pid, job->id);
+}
+
+Job* job_add(pid_t pid, char** argv) {
+    /*
+     * Adds a process to the table of background jobs
+     *
+     * Arguments:
+     *  pid: The pid of the child process
+     *  argv: The NULL terminated input array of strings, it gets copied
+     *
+     * Returns: The new job. The pointer is only valid until the next job is added
+     */
+
+    Job* job = job_new(argv);
+    job_started(job, pid);
+
+    printf("[%d] %s%d%s started in the background\n", job->id, colors[PID_COLOR], pid, color_reset);
+
+    return job;
+}
+
+int jobs_should_queue() {
+    /*
+     * Returns: Whether a new background job has to wait for a slot, because jobmax are
+     *          already running or others are waiting before it
+     */
+
+    if (job_table.max_running <= 0)
+        return 0;
+
+    if (sigchld_pending)
+        jobs_reap();
+
+    return job_table.running >= job_table.max_running || job_table.queue_head != 0;
+}
+
+Job* job_queue(char** argv, int builtin, char* path, int fds[3]) {
+    /*
+     * Adds a background job that's started once a slot frees up, after the jobs queued before it
+     *
+     * Arguments:
+     *  argv: The NULL terminated input array of strings, it gets copied
+     *  builtin: Whether argv[0] is a builtin, otherwise path is run
+     *  path: The executable, it gets copied
+     *  fds: The descriptors the job is started with, which the job now owns
+     *
+     * Returns: The new job. The pointer is only valid until the next job is added
+     */
+
+    Job* job = job_new(argv);
+    job->state = JOB_QUEUED;
+    job->argv = copy_argv(argv);
+    // Loading or unloading builtins moves the registry, so it's looked up by name when it starts
+    job->builtin = builtin;
+    job->patterns = builtin ? copy_deferred_patterns(argv) : NULL;
+    job->path = (path != NULL) ? strdup(path) : NULL;
+    memcpy(job->fds, fds, sizeof(job->fds));
+
+    if (job_table.queue_tail != 0)
+        job_table.jobs[job_table.queue_tail - 1].next = job->id;
+    else
+        job_table.queue_head = job->id;
+    job_table.queue_tail = job->id;
+
+    printf("[%d] queued behind %d running job%s\n", job->id, job_table.running, job_table.running == 1 ? "" : "s");
+
+    return job;
+}
+
+static void job_finished(Job* job, int status) {
+    /*
+     * Queues up a job that's done to be reported
+     */
+
+    job->state = JOB_DONE;
+    job->status = status;
+    clock_gettime(CLOCK_MONOTONIC, &job->end_time);
+
+    job->next = 0;
+    if (job_table.done_tail != 0)
+        job_table.jobs[job_table.done_tail - 1].next = job->id;
+    else
+        job_table.done_head = job->id;
+    job_table.done_tail = job->id;
+}
+
+void jobs_start_queued() {
+    /*
+     * Starts queued jobs, oldest first, while there are free slots
+     */
+
+    while (job_table.queue_head != 0 &&
+           (job_table.max_running <= 0 || job_table.running < job_table.max_running)) {
+        Job* job = &job_table.jobs[job_table.queue_head - 1];
+
+        job_table.queue_head = job->next;
+        if (job_table.queue_head == 0)
+            job_table.queue_tail = 0;
+
+        pid_t pid;
+        int missing = 0;
+
+        if (job->builtin) {
+            Builtin* builtin = find_builtin(job->argv[0]);
+
+            if (builtin != NULL)
+                pid = fork_queued_builtin(job, builtin);
+            else {
+                // Unloaded with enable -d while the job was waiting
+                missing = 1;
+                pid = -1;
+            }
+        }
+        else {
+            SpawnRequest request;
+            spawn_request_init(&request, job->argv);
+
+            request.path = job->path;
+            memcpy(request.fds, job->fds, sizeof(request.fds));
+
+            pid = spawn_process(&request);
+        }
+
+        // The descriptors were only needed to start it
+        SpawnRequest fds;
+        spawn_request_init(&fds, NULL);
+        memcpy(fds.fds, job->fds, sizeof(fds.fds));
+        close_request_fds(&fds);
+
+        if (job->patterns != NULL) {
+            for (int i = 0; job->argv[i] != NULL; i++)
+                free(job->patterns[i]);
+            free(job->patterns);
+            job->patterns = NULL;
+        }
+
+        free(job->argv);
+        free(job->path);
+        job->argv = NULL;
+        job->path = NULL;
+
+        if (pid == -1 && missing) {
+            fprintf(stderr, "%serror%s: [%d] %s: the builtin is gone\n", colors[ERR_COLOR], color_reset, job->id, job->command);
+            job_finished(job, 127);
+        }
+        else if (pid == -1) {
+            fprintf(stderr, "%serror%s: [%d] %s: %s\n", colors[ERR_COLOR], color_reset, job->id, job->command, strerror(errno));
+            job_finished(job, 126);
+        }
+        else
+            job_started(job, pid);
+    }
+}
+
+Job* job_by_id(int id) {
+    if (id < 1 || id > job_table.slots_used || job_table.jobs[id - 1].id == 0)
+        return NULL;
+
+    return &job_table.jobs[id - 1];
+}
+
+Job* job_by_pid(pid_t pid) {
+    int b = pid_find(pid);
+
+    if (b == -1)
+        return NULL;
+
+    return &job_table.jobs[job_table.pid_values[b] - 1];
+}
+
+static void job_free(Job* job) {
+    // Closing the pidfd also takes it out of the event loop
+    if (job->pidfd != -1)
+        close(job->pidfd);
+
+    free(job->command);
+    job->command = NULL;
+    job->id = 0;
+
+    int id = job - job_table.jobs + 1;
+    job->next = job_table.free_head;
+    job_table.free_head = id;
+
+    job_table.count--;
+}
+
+static void job_changed(pid_t pid, int status, const struct rusage* usage) {
+    /*
+     * Records a state change of a child returned by wait4(), with what it used if it's done
+     */
+
+    Job* job = job_by_pid(pid);
+
+    // Not one of ours
+    if (job == NULL)
+        return;
+
+    if (WIFSTOPPED(status))
+        job->state = JOB_STOPPED;
+    else if (WIFCONTINUED(status))
+        job->state = JOB_RUNNING;
+    else {
+        // The pid may get reused by a new job before this one is reported
+        job_table.pid_keys[pid_find(pid)] = PID_DELETED;
+        job_table.running--;
+
+        job->usage = *usage;
+        job_finished(job, exit_status(status));
+    }
+}
+
+void jobs_reap() {
+    /*
+     * Collects every child that changed state, not just one per SIGCHLD, since signals
+     * arriving close together get merged, then starts queued jobs in the slots that freed up
+     */
+
+    sigchld_pending = 0;
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+        job_changed(pid, status, &usage);
+
+    jobs_start_queued();
+}
+
+static int job_pending(Job* job) {
+    return job->id != 0 && (job->state == JOB_RUNNING || job->state == JOB_QUEUED);
+}
+
+int jobs_wait(int id) {
+    /*
+     * Blocks until a job, or every job, is done. Queued jobs are started as slots free up
+     * meanwhile. Stopped jobs aren't waited for, since they'd never finish on their own
+     *
+     * Arguments:
+     *  id: The job number, or 0 for all of them
+     *
+     * Returns: The job's exit status, 0 when waiting for all of them
+     */
+
+    while (1) {
+        jobs_reap();
+
+        int pending = 0;
+
+        if (id != 0)
+            pending = job_pending(&job_table.jobs[id - 1]);
+        else {
+            for (int i = 0; i < job_table.slots_used && !pending; i++)
+                pending = job_pending(&job_table.jobs[i]);
+        }
+
+        if (!pending)
+            break;
+
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, WUNTRACED | WCONTINUED, &usage);
+
+        if (pid > 0)
+            job_changed(pid, status, &usage);
+        else if (errno == ECHILD)
+            break;
+    }
+
+    return (id != 0) ? job_table.jobs[id - 1].status : 0;
+}
+
+void jobs_notify() {
+    /*
+     * Reports the jobs that finished since the last call, and frees their slots
+     */
+
+    if (sigchld_pending)
+        jobs_reap();
+
+    int id = job_table.done_head;
+
+    while (id != 0) {
+        Job* job = &job_table.jobs[id - 1];
+        int next = job->next;
+
+        printf("[%d] %s%d%s done", job->id, colors[PID_COLOR], job->pid, color_reset);
+
+        if (job->status != 0)
+            printf(" (exit %d)", job->status);
+
+        printf("  %s\n", job->command);
+
+        job_free(job);
+        id = next;
+    }
+
+    job_table.done_head = 0;
+    job_table.done_tail = 0;
+}
+
+static int read_proc_usage(pid_t pid, struct rusage* usage) {
+    /*
+     * Reads what a running process has used so far, in the same form wait4() reports it in.
+     * Unlike wait4(), it only covers the process itself, not the children it waited for
+     *
+     * Returns: 1 on success, 0 if the process is gone
+     */
+
+    char path[64];
+    char line[256];
+
+    memset(usage, 0, sizeof(struct rusage));
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* file = fopen(path, "re");
+    if (file == NULL)
+        return 0;
+
+    // The command name may contain spaces and parentheses, the fields start after the last ')'
+    unsigned long utime = 0, stime = 0;
+    if (fgets(line, sizeof(line), file) != NULL && strrchr(line, ')') != NULL)
+        sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+
+    fclose(file);
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    usage->ru_utime.tv_sec = utime / ticks;
+    usage->ru_utime.tv_usec = (utime % ticks) * 1000000 / ticks;
+    usage->ru_stime.tv_sec = stime / ticks;
+    usage->ru_stime.tv_usec = (stime % ticks) * 1000000 / ticks;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    file = fopen(path, "re");
+    if (file == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        sscanf(line, "VmHWM: %ld", &usage->ru_maxrss);
+        sscanf(line, "voluntary_ctxt_switches: %ld", &usage->ru_nvcsw);
+        sscanf(line, "nonvoluntary_ctxt_switches: %ld", &usage->ru_nivcsw);
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+void jobs_print(int long_format) {
+    /*
+     * Lists the jobs in order of their job number
+     *
+     * Arguments:
+     *  long_format: Also show what each finished job used
+     */
+
+    if (sigchld_pending)
+        jobs_reap();
+
+    if (job_table.count == 0) {
+        printf("none\n");
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int i = 0; i < job_table.slots_used; i++) {
+        Job* job = &job_table.jobs[i];
+
+        if (job->id == 0)
+            continue;
+
+        struct timespec* until = (job->state == JOB_DONE) ? &job->end_time : &now;
+        double elapsed = (until->tv_sec - job->start_time.tv_sec) + (until->tv_nsec - job->start_time.tv_nsec) / 1e9;
+
+        // A queued job has no pid yet, and its time is how long it's been waiting
+        if (job->state == JOB_QUEUED)
+            printf("[%d] - %-8s %8.1fs  %s", job->id, state_names[job->state], elapsed, job->command);
+        else
+            printf("[%d] %s%d%s %-8s %8.1fs  %s", job->id, colors[PID_COLOR], job->pid, color_reset,
+                    state_names[job->state], elapsed, job->command);
+
+        if (job->state == JOB_DONE)
+            printf("  (exit %d)", job->status);
+
+        printf("\n");
+
+        if (!long_format || job->state == JOB_QUEUED)
+            continue;
+
+        // A job that's still going is measured so far, from /proc
+        if (job->state != JOB_DONE && !read_proc_usage(job->pid, &job->usage))
+            continue;
+
+        printf("      user %.3fs  sys %.3fs  maxrss %.1fM  vcsw %ld  ivcsw %ld\n",
+                usage_seconds(&job->usage.ru_utime), usage_seconds(&job->usage.ru_stime),
+                job->usage.ru_maxrss / 1024.0, job->usage.ru_nvcsw, job->usage.ru_nivcsw);
+    }
+
+    if (job_table.max_running > 0)
+        printf("%d running, at most %d at a time\n", job_table.running, job_table.max_running);
+}
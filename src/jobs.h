@@ -0,0 +1,80 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define JOBS_INITIAL_CAPACITY 16
+
+typedef enum JobState {
+    JOB_QUEUED,                     // waiting for a slot under jobmax
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+typedef struct Job {
+    int id;                         // job number, 0 while the slot is free
+    pid_t pid;
+    JobState state;
+    int status;                     // exit status, once done
+    struct timespec start_time;
+    struct timespec end_time;
+    struct rusage usage;            // from wait4(), once done
+    char* command;
+    int pidfd;                      // watched by the interactive loop, -1 if not
+    int next;                       // next job number in the free list, the done list or the queue
+
+    // What a queued job is started with, released once it starts
+    char** argv;
+    char* path;                     // the executable, NULL for a builtin
+    int builtin;                    // argv[0] is a builtin, looked up again when the job starts
+    char** patterns;                // the brace pattern of each deferred argument, NULL if none are
+    int fds[3];
+} Job;
+
+// Background jobs, indexed by job number and by pid
+typedef struct JobTable {
+    Job* jobs;                      // slot n - 1 holds job number n
+    int capacity;
+    int count;                      // jobs that haven't been reported done yet
+
+    int free_head;                  // stack of job numbers to reuse
+    int slots_used;                 // slots handed out so far
+
+    int done_head;                  // queue of jobs that finished since the last report
+    int done_tail;
+
+    int running;                    // jobs that were started and haven't finished, stopped ones included
+    int max_running;                // jobs beyond this many wait in the queue, 0 for no limit
+    int queue_head;                 // FIFO of jobs waiting to start
+    int queue_tail;
+
+    // Open addressing hash from pid to job number. 0 marks an empty bucket, -1 a deleted one
+    pid_t* pid_keys;
+    int* pid_values;
+    int pid_capacity;
+    int pid_used;                   // live and deleted buckets
+} JobTable;
+
+extern JobTable job_table;
+extern volatile sig_atomic_t sigchld_pending;
+
+void jobs_init();
+Job* job_add(pid_t pid, char** argv);
+Job* job_queue(char** argv, int builtin, char* path, int fds[3]);
+int jobs_should_queue();
+void jobs_start_queued();
+Job* job_by_id(int id);
+Job* job_by_pid(pid_t pid);
+
+void jobs_reap();
+int jobs_wait(int id);
+void jobs_notify();
+void jobs_print(int long_format);
+
+void sigchld_handler(int sig);
+
+#endif
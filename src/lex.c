@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lex.h"
+#include "arena.h"
+
+// Distinct objects, so that a quoted "|" word never compares equal to the pipe operator
+char* const token_strings[] = {
+    [TOK_WORD]   = NULL,
+    [TOK_PIPE]   = "|",
+    [TOK_AMP]    = "&",
+    [TOK_GREAT]  = ">",
+    [TOK_DGREAT] = ">>",
+    [TOK_LESS]   = "<",
+    [TOK_END]    = NULL,
+    [TOK_ERROR]  = NULL,
+};
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int is_operator_char(char c) {
+    return c == '|' || c == '&' || c == '>' || c == '<';
+}
+
+void lexer_init(Lexer* lexer, const char* buffer) {
+    /*
+     * Prepares a lexer to tokenize a null terminated input buffer
+     */
+
+    lexer->buffer = buffer;
+    lexer->pos = 0;
+}
+
+TokenType next_token(Lexer* lexer, Token* token) {
+    /*
+     * Scans the next token of the input buffer. Every character is looked at exactly once
+     *
+     * Arguments:
+     *  lexer: The lexer state
+     *  token: Gets the type and the (offset, length) slice of the token
+     *
+     * Returns: The token type, TOK_END at the end of the input,
+     *          or TOK_ERROR if a string quote is never closed
+     */
+
+    const char* buf = lexer->buffer;
+    size_t i = lexer->pos;
+
+    while (is_blank(buf[i]))
+        i++;
+
+    // A '#' at the start of a word comments out the rest of the line
+    if (buf[i] == '#')
+        i += strlen(&buf[i]);
+
+    token->offset = i;
+    token->flags = 0;
+
+    if (buf[i] == '\0') {
+        token->type = TOK_END;
+        token->length = 0;
+        lexer->pos = i;
+        return TOK_END;
+    }
+
+    if (is_operator_char(buf[i])) {
+        switch (buf[i]) {
+            case '|': token->type = TOK_PIPE; break;
+            case '&': token->type = TOK_AMP;  break;
+            case '<': token->type = TOK_LESS; break;
+            case '>':
+                if (buf[i + 1] == '>') {
+                    token->type = TOK_DGREAT;
+                    i++;
+                }
+                else
+                    token->type = TOK_GREAT;
+                break;
+        }
+
+        i++;
+        token->length = i - token->offset;
+        lexer->pos = i;
+        return token->type;
+    }
+
+    // A word runs until an unquoted blank or operator
+    enum { UNQUOTED, SINGLE, DOUBLE } state = UNQUOTED;
+
+    while (buf[i] != '\0') {
+        char c = buf[i];
+
+        if (state == UNQUOTED) {
+            if (is_blank(c) || is_operator_char(c))
+                break;
+
+            if (c == '\'') {
+                state = SINGLE;
+                token->flags |= TOKEN_QUOTED;
+            }
+            else if (c == '"') {
+                state = DOUBLE;
+                token->flags |= TOKEN_QUOTED;
+            }
+            else if (c == '\\') {
+                token->flags |= TOKEN_QUOTED;
+                if (buf[i + 1] != '\0')
+                    i++;
+            }
+            else if (c == '*' || c == '?' || c == '[')
+                token->flags |= TOKEN_GLOB;
+            else if (c == '{')
+                token->flags |= TOKEN_BRACE;
+        }
+        else if (state == SINGLE) {
+            if (c == '\'')
+                state = UNQUOTED;
+        }
+        else {
+            if (c == '"')
+                state = UNQUOTED;
+            else if (c == '\\' && buf[i + 1] != '\0')
+                i++;
+        }
+
+        i++;
+    }
+
+    token->length = i - token->offset;
+    lexer->pos = i;
+
+    token->type = (state == UNQUOTED) ? TOK_WORD : TOK_ERROR;
+    return token->type;
+}
+
+char* token_text(const char* buffer, const Token* token, Arena* arena) {
+    /*
+     * Copies a token out of the input buffer, removing its quotes and escapes
+     *
+     * Arguments:
+     *  buffer: The input buffer the token was scanned from
+     *  token: The token slice
+     *  arena: The arena the copy is allocated from
+     *
+     * Returns: The null terminated word. Operators return their entry in token_strings
+     */
+
+    if (token->type != TOK_WORD)
+        return token_strings[token->type];
+
+    const char* src = buffer + token->offset;
+
+    if (!(token->flags & TOKEN_QUOTED))
+        return arena_strndup(arena, src, token->length);
+
+    // Quote removal never makes a word longer
+    char* text = arena_alloc(arena, token->length + 1);
+    size_t j = 0;
+
+    enum { UNQUOTED, SINGLE, DOUBLE } state = UNQUOTED;
+
+    for (size_t i = 0; i < token->length; i++) {
+        char c = src[i];
+
+        if (state == UNQUOTED) {
+            if (c == '\'')
+                state = SINGLE;
+            else if (c == '"')
+                state = DOUBLE;
+            else if (c == '\\' && i + 1 < token->length)
+                text[j++] = src[++i];
+            else
+                text[j++] = c;
+        }
+        else if (state == SINGLE) {
+            if (c == '\'')
+                state = UNQUOTED;
+            else
+                text[j++] = c;
+        }
+        else {
+            // Inside double quotes a backslash only escapes the characters that are special there
+            if (c == '"')
+                state = UNQUOTED;
+            else if (c == '\\' && i + 1 < token->length && strchr("\"\\$`", src[i + 1]) != NULL)
+                text[j++] = src[++i];
+            else
+                text[j++] = c;
+        }
+    }
+
+    text[j] = '\0';
+
+    return text;
+}
+
+char* token_pattern(const char* buffer, const Token* token, Arena* arena) {
+    /*
+     * Copies a glob or brace word out of the input buffer, with its quotes removed like
+     * token_text() does, but with every quoted or escaped pattern character escaped with a
+     * backslash, so it stands only for itself
+     *
+     * Returns: The null terminated pattern
+     */
+
+    const char* src = buffer + token->offset;
+
+    // At worst every character gets escaped
+    char* pattern = arena_alloc(arena, token->length * 2 + 1);
+    size_t j = 0;
+
+    enum { UNQUOTED, SINGLE, DOUBLE } state = UNQUOTED;
+
+    for (size_t i = 0; i < token->length; i++) {
+        char c = src[i];
+        int literal = 1;
+
+        if (state == UNQUOTED) {
+            if (c == '\'')
+                state = SINGLE;
+            else if (c == '"')
+                state = DOUBLE;
+            else if (c == '\\' && i + 1 < token->length)
+                c = src[++i];
+            else
+                literal = 0;
+
+            if (state != UNQUOTED)
+                continue;
+        }
+        else if (state == SINGLE) {
+            if (c == '\'') {
+                state = UNQUOTED;
+                continue;
+            }
+        }
+        else {
+            if (c == '"') {
+                state = UNQUOTED;
+                continue;
+            }
+            else if (c == '\\' && i + 1 < token->length && strchr("\"\\$`", src[i + 1]) != NULL)
+                c = src[++i];
+        }
+
+        if (literal && strchr("*?[]{},\\", c) != NULL)
+            pattern[j++] = '\\';
+
+        pattern[j++] = c;
+    }
+
+    pattern[j] = '\0';
+
+    return pattern;
+}
+
+int is_operator(const char* word, TokenType type) {
+    /*
+     * Checks whether an argv entry is the given operator token, and not a quoted word
+     * that happens to spell the same
+     */
+
+    return word != NULL && word == token_strings[type];
+}
@@ -0,0 +1,51 @@
+#ifndef LEX_H
+#define LEX_H
+
+#include <stddef.h>
+
+#include "arena.h"
+
+typedef enum TokenType {
+    TOK_WORD,
+    TOK_PIPE,       // |
+    TOK_AMP,        // &
+    TOK_GREAT,      // >
+    TOK_DGREAT,     // >>
+    TOK_LESS,       // <
+    TOK_END,
+    TOK_ERROR
+} TokenType;
+
+// Set on a word token that contains quotes or escapes, and needs them removed
+#define TOKEN_QUOTED 1
+
+// Set on a word token with an unquoted '*', '?' or '[', to be expanded as a glob pattern
+#define TOKEN_GLOB   2
+
+// Set on a word token with an unquoted '{', which may be a brace or sequence expression
+#define TOKEN_BRACE  4
+
+// A slice of the input buffer
+typedef struct Token {
+    TokenType type;
+    size_t offset;
+    size_t length;
+    int flags;
+} Token;
+
+typedef struct Lexer {
+    const char* buffer;
+    size_t pos;
+} Lexer;
+
+// The argv representation of each operator token, compared by address
+extern char* const token_strings[];
+
+void lexer_init(Lexer* lexer, const char* buffer);
+TokenType next_token(Lexer* lexer, Token* token);
+char* token_text(const char* buffer, const Token* token, Arena* arena);
+char* token_pattern(const char* buffer, const Token* token, Arena* arena);
+
+int is_operator(const char* word, TokenType type);
+
+#endif
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+#include <readline/readline.h>
+
+#include "main.h"
+#include "loop.h"
+#include "execute.h"
+#include "jobs.h"
+#include "prompt.h"
+#include "segments.h"
+#include "history.h"
+#include "histindex.h"
+#include "complete.h"
+#include "trace.h"
+
+#include "globals.h"
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+
+// Handed over by readline's line handler, and executed by the loop
+static char* pending_line = NULL;
+static int line_ready = 0;
+
+static const char* current_prompt = NULL;
+
+static void line_handler(char* line) {
+    /*
+     * Called by readline when a whole line has been entered, or with NULL on Ctrl + D
+     */
+
+    pending_line = line;
+    line_ready = 1;
+
+    // Otherwise readline starts on the next line right away, printing the prompt again.
+    // This also gives the terminal back while the command runs
+    rl_callback_handler_remove();
+}
+
+static void install_prompt() {
+    current_prompt = generate_prompt();
+
+    rl_callback_handler_install(current_prompt, line_handler);
+}
+
+static void redraw_prompt(int notices) {
+    /*
+     * Draws the prompt again with whatever was being typed, printing the jobs that finished
+     * above it first if asked to
+     */
+
+    // Wipe every line of the prompt, the edit line being the last one
+    int prompt_lines = 0;
+    for (const char* c = current_prompt; *c; c++) {
+        if (*c == '\n')
+            prompt_lines++;
+    }
+
+    printf("\r\033[K");
+    for (int i = 0; i < prompt_lines; i++)
+        printf("\033[A\r\033[K");
+
+    if (notices)
+        jobs_notify();
+    fflush(stdout);
+
+    // The job count or a segment may have changed along the way
+    current_prompt = generate_prompt();
+    rl_set_prompt(current_prompt);
+
+    rl_on_new_line();
+    rl_forced_update_display();
+}
+
+static void print_job_notices() {
+    if (job_table.done_head != 0)
+        redraw_prompt(1);
+}
+
+static void handle_signals() {
+    struct signalfd_siginfo info;
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD)
+            jobs_reap();
+        else if (info.ssi_signo == SIGWINCH) {
+            rl_resize_terminal();
+            prompt_invalidate(PROMPT_WIDTH);
+        }
+    }
+}
+
+int loop_watch_process(pid_t pid) {
+    /*
+     * Starts watching a background job through a pidfd, so its exit is noticed right away
+     *
+     * Returns: The pidfd, which the caller closes once the job is gone. -1 if the loop isn't
+     *          running or pidfds aren't supported, SIGCHLD still covers the job then
+     */
+
+    if (epoll_fd == -1)
+        return -1;
+
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+
+    if (pidfd == -1)
+        return -1;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = LOOP_JOB | (uint32_t) pid;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == -1) {
+        close(pidfd);
+        return -1;
+    }
+
+    return pidfd;
+}
+
+void interactive_loop() {
+    /*
+     * Reads and executes commands, waiting with epoll on the terminal, on a signalfd for SIGCHLD
+     * and SIGWINCH, on the pidfd of every background job, and on the prompt segments computed in
+     * the background. Readline is driven through its callback interface, so finished jobs and
+     * segments are drawn while the user is still typing
+     */
+
+    // The signals are read from the signalfd, so they must not be delivered the usual way
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+
+    event.data.u64 = LOOP_STDIN;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event);
+
+    event.data.u64 = LOOP_SIGNALS;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+
+    event.data.u64 = LOOP_PROMPT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, segments_fd(), &event);
+
+    // We handle resizes ourselves
+    rl_catch_sigwinch = 0;
+
+    history_init();
+    complete_init();
+
+    install_prompt();
+
+    // After readline has read its init file, so our bindings win
+    histindex_bind_keys();
+
+    // The history is indexed for searching whenever there's nothing else to do
+    int indexing = 1;
+
+    // How long the shell sat at the prompt, typing included
+    long long prompt_start = trace_begin();
+
+    while (1) {
+        struct epoll_event events[LOOP_MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, LOOP_MAX_EVENTS, indexing ? 0 : -1);
+
+        if (n == 0) {
+            indexing = histindex_idle();
+            continue;
+        }
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "%serror%s: epoll_wait failed: %s\n", colors[ERR_COLOR], color_reset, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint64_t source = events[i].data.u64 & ~0xffffffffULL;
+
+            if (source == LOOP_STDIN)
+                rl_callback_read_char();
+            else if (source == LOOP_SIGNALS)
+                handle_signals();
+            else if (source == LOOP_JOB)
+                jobs_reap();
+            else if (source == LOOP_PROMPT && segments_collect() && !line_ready)
+                redraw_prompt(0);
+
+            if (line_ready)
+                break;
+        }
+
+        if (!line_ready) {
+            print_job_notices();
+            continue;
+        }
+
+        line_ready = 0;
+        trace_end("readline", prompt_start, -1, -1, NULL);
+
+        // Ctrl + D, readline already moved to a new line
+        if (pending_line == NULL)
+            break;
+
+        execute_line(pending_line);
+
+        // Add history if line is not empty
+        if (*pending_line)
+            history_add(pending_line, last_exit_status);
+        free(pending_line);
+        pending_line = NULL;
+
+        jobs_reap();
+        report_bg_processes();
+
+        history_sync();
+        segments_refresh();
+        install_prompt();
+        prompt_start = trace_begin();
+    }
+
+    close(epoll_fd);
+    close(signal_fd);
+    epoll_fd = -1;
+}
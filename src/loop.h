@@ -0,0 +1,18 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define LOOP_MAX_EVENTS 64
+
+// What an epoll event's data refers to, in its top 32 bits. The pid of a job's pidfd is in the low bits
+#define LOOP_STDIN    (1ULL << 32)
+#define LOOP_SIGNALS  (2ULL << 32)
+#define LOOP_JOB      (3ULL << 32)
+#define LOOP_PROMPT   (4ULL << 32)
+
+void interactive_loop();
+int loop_watch_process(pid_t pid);
+
+#endif
@@ -3,21 +3,28 @@
 #include <string.h>
 
 #include <unistd.h>
+#include <pwd.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#include <time.h>
 
-#include <readline/readline.h>
-#include <readline/history.h>
 
 #include "main.h"
 #include "execute.h"
 #include "parse.h"
+#include "arena.h"
+#include "reader.h"
+#include "spawn.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "loop.h"
+#include "trace.h"
 
-// ==================================== globals ==================================== 
+#include "globals.h"
 
-// Flag set by the SIGCHLD signal handler. contains the terminated child pid
-int sigchld_flag = 0;
+// ==================================== globals ==================================== 
 
 // Global constants for the username and hostname
 char* username;
@@ -29,161 +36,164 @@ const char* color_reset = "\e[0m";
 
 int accent_color = 5;
 
-BgProcess bg_processes[MAX_BG_PROC];
+// Backs every allocation made while parsing and executing a single command line
+Arena line_arena;
 
-// ================================================================================= 
+// Exit status of the last executed command line
+int last_exit_status = 0;
 
-int main() {
+// Set when the shell reads commands from a script, a string, or a non-terminal stdin
+int batch_mode = 0;
 
-    print_greeting();
+// Startup timestamp, used to report how long it takes to reach the first exec
+static struct timespec startup_time;
+static int startup_report = 0;
+
+// ================================================================================= 
 
-    // Arguments vector
-    char** input;
+int main(int argc, char** argv) {
 
-    char*** array_of_inputs;
+    clock_gettime(CLOCK_MONOTONIC, &startup_time);
+    startup_report = getenv("CASH_STARTUP_REPORT") != NULL;
 
     // Initialize username and hostname
     username = getlogin();
+
+    // getlogin() fails without a controlling terminal, fall back to the password database
+    if (username == NULL) {
+        struct passwd* pw = getpwuid(getuid());
+        username = (pw != NULL) ? pw->pw_name : "?";
+    }
+
     hostname = malloc(sizeof(char) * MAX_SIZE);
     gethostname(hostname, MAX_SIZE);
     hostname = realloc(hostname, sizeof(char) * (strlen(hostname) + 1));
 
-    // Initialize background processes array
-    for (int i = 0; i < MAX_BG_PROC; i++)
-        bg_processes[i].pid = -1;
+    jobs_init();
+    spawn_init();
+    builtins_init();
+    trace_init();
 
-    while (1) {
-        input = parse_input();
+    // cash -c "command"
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "%serror%s: -c requires an argument\n", colors[ERR_COLOR], color_reset);
+            return 2;
+        }
 
-        array_of_inputs = separate_inputs(input);
+        batch_mode = 1;
+        return run_string(argv[2]);
+    }
 
-        if (array_of_inputs == NULL)
-            execute_input(input);
-        else
-            execute_piped_inputs(array_of_inputs);
+    // cash script
+    if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
 
+        if (fd < 0) {
+            fprintf(stderr, "%serror%s: can't open '%s'\n", colors[ERR_COLOR], color_reset, argv[1]);
+            return 127;
+        }
 
-        free_array_of_inputs(array_of_inputs);
-        free_input(input);
-    }
+        batch_mode = 1;
+        int status = run_stream(fd);
+        close(fd);
 
-    return 0;
-}
+        return status;
+    }
 
-void free_input(char** input) {
-    /*
-     * Frees each malloc'd string and the malloc'd array of char pointers
-     */
+    // Commands piped into the shell
+    if (!isatty(STDIN_FILENO)) {
+        batch_mode = 1;
+        return run_stream(STDIN_FILENO);
+    }
 
-    if (input == NULL)
-        return;
+    print_greeting();
 
-    int i = 0;
-    while(input[i] != NULL) {
-        free(input[i]);
-        i++;
-    }
+    interactive_loop();
 
-    free(input);
+    return last_exit_status;
 }
 
-void free_array_of_inputs(char*** array_of_inputs) {
+int run_stream(int fd) {
     /*
+     * Executes every line read from a file descriptor, without any prompt or line editing
+     *
+     * Arguments:
+     *  fd: The file descriptor to read commands from
+     *
+     * Returns: The exit status of the last command
      */
 
-    if (array_of_inputs == NULL)
-        return;
+    LineReader reader;
+    reader_init(&reader, fd);
+
+    char* line;
+    while ((line = reader_next_line(&reader)) != NULL) {
+        report_bg_processes();
 
-    int i = 0;
-    while(array_of_inputs[i] != NULL) {
-        free_input(array_of_inputs[i]);
-        i++;
+        // Commands sharing our stdin should start reading right after this line
+        if (fd == STDIN_FILENO)
+            reader_sync(&reader);
+
+        execute_line(line);
     }
 
-    free(array_of_inputs);
+    reader_free(&reader);
+
+    return last_exit_status;
 }
 
-char* generate_prompt() {
+int run_string(char* commands) {
     /*
-     * Generates a cute looking prompt
+     * Executes each line of a command string
+     *
+     * Arguments:
+     *  commands: The newline separated commands
      *
-     * Returns: The generated prompt
+     * Returns: The exit status of the last command
      */
 
-    // get terminal size
-    struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-
-    // get current working directory
-    char current_dir[MAX_SIZE];
-    getcwd(current_dir, sizeof(current_dir));
-
-    if (strcmp(current_dir, getenv("HOME")) == 0)
-        strcpy(current_dir, "~");
-
-    // truncate the last two directories by default
-    truncate_dir(current_dir, 2);
+    char* line = commands;
 
-    // note: 7 is the other decorative characters
-    int filler_line_length = w.ws_col - (strlen(username) + strlen(hostname) + strlen(current_dir) + 7);
+    while (line != NULL) {
+        char* newline = strchr(line, '\n');
 
-    // fill out the filler line
-    char filler_line[FILLER_LINE_SIZE];
-    filler_line[0] = '\0';
-    
-    for (int i = 0; i < filler_line_length; i++)
-        strcat(filler_line, "─");
+        if (newline != NULL)
+            *newline = '\0';
 
-    char* prompt = malloc(sizeof(char) * MAX_PROMPT_SIZE);
-    snprintf(prompt, MAX_PROMPT_SIZE, "┌─{%s%s%s@%s%s%s}%s{%s%s%s}\n└─%s♥%s ",
-            colors[accent_color], username, color_reset,
-            colors[accent_color], hostname, color_reset, filler_line,
-            colors[accent_color], current_dir, color_reset,
-            colors[accent_color], color_reset);
+        report_bg_processes();
+        execute_line(line);
 
-    prompt = realloc(prompt, sizeof(char) * (strlen(prompt) + 1));
+        line = (newline != NULL) ? newline + 1 : NULL;
+    }
 
-    return prompt;
+    return last_exit_status;
 }
 
-void truncate_dir(char* dir_name, int truncate_length) {
+void report_bg_processes() {
     /*
-     * Truncates the working directory string to the last specified directories
-     *
-     * Arguments:
-     *  dir_name: A string containing the directory name
-     *  truncate_length: The number of remaining directories in the end after truncating the rest
+     * Reports the background jobs that terminated since the last command
      */
 
-    int slash_occurences = 0;
-    
-    // First count the number of occurences of the forward slash character
-    int i = 0;
-    while(dir_name[i] != '\0') {
-        if (dir_name[i] == '/')
-            slash_occurences++;
-
-        i++;
-    }
+    jobs_notify();
+}
 
-    if (slash_occurences >= truncate_length) {
-        slash_occurences = 0;
+void report_startup_latency() {
+    /*
+     * Prints how long the shell took from starting up to its first fork-exec,
+     * once, if CASH_STARTUP_REPORT is set
+     */
 
-        // Then we'll start from the end of the string, looking for the point at which to truncate
-        int j = strlen(dir_name) - 1;
-        while (slash_occurences != truncate_length) {
-            if (dir_name[j] == '/')
-                slash_occurences++;
+    if (!startup_report)
+        return;
 
-            j--;
-        }
+    startup_report = 0;
 
-        // Readjust the counter
-        j += 2;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-        // Overwrite the truncated string on top of the original string
-        memcpy(dir_name, &dir_name[j], i - j + 1);
-    }
+    double elapsed_ms = (now.tv_sec - startup_time.tv_sec) * 1e3 + (now.tv_nsec - startup_time.tv_nsec) / 1e6;
+    fprintf(stderr, "cash: startup to first exec: %.3f ms\n", elapsed_ms);
 }
 
 void print_greeting() {
@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "parallel.h"
+#include "batch.h"
+#include "execute.h"
+#include "spawn.h"
+#include "pathcache.h"
+#include "builtins.h"
+#include "utilities.h"
+
+#include "globals.h"
+
+static int cpu_count() {
+    /*
+     * Returns: The number of CPUs the shell may run on, which honors taskset and cpusets
+     */
+
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        return CPU_COUNT(&set);
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return online > 0 ? online : 1;
+}
+
+static char* substitute(const char* arg, const char* word) {
+    /*
+     * Replaces every "{}" in an argument with the word
+     *
+     * Returns: A new string
+     */
+
+    size_t arg_length = strlen(arg);
+    size_t word_length = strlen(word);
+
+    size_t count = 0;
+    for (const char* p = arg; (p = strstr(p, "{}")) != NULL; p += 2)
+        count++;
+
+    char* result = malloc(arg_length + count * word_length + 1);
+    char* end = result;
+
+    for (const char* p = arg; *p != '\0';) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(end, word, word_length);
+            end += word_length;
+            p += 2;
+        }
+        else
+            *end++ = *p++;
+    }
+
+    *end = '\0';
+
+    return result;
+}
+
+static char** job_argv(char** command, int command_argc, const char* word, int placeholder) {
+    /*
+     * Builds the argument vector of one job: the word in place of every "{}", or appended
+     * if there isn't one
+     *
+     * Returns: A NULL terminated array whose strings are all newly allocated
+     */
+
+    char** argv = malloc(sizeof(char*) * (command_argc + 2));
+    int argc = 0;
+
+    for (int i = 0; i < command_argc; i++)
+        argv[argc++] = placeholder ? substitute(command[i], word) : strdup(command[i]);
+
+    if (!placeholder)
+        argv[argc++] = strdup(word);
+
+    argv[argc] = NULL;
+
+    return argv;
+}
+
+static char* join_words(char** argv) {
+    size_t length = 1;
+    for (int i = 0; argv[i] != NULL; i++)
+        length += strlen(argv[i]) + 1;
+
+    char* joined = malloc(length);
+    char* end = joined;
+
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (i > 0)
+            *end++ = ' ';
+
+        size_t n = strlen(argv[i]);
+        memcpy(end, argv[i], n);
+        end += n;
+    }
+
+    *end = '\0';
+
+    return joined;
+}
+
+static int start_job(ParallelJob* job, char** argv, char* path, Builtin* builtin, int in_fd) {
+    /*
+     * Starts one job in a free slot, with its output going to the slot's memfds
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    int fds[3] = { in_fd, job->out_fd, job->err_fd };
+
+    if (builtin != NULL)
+        job->pid = fork_builtin(builtin, argv, fds);
+    else {
+        SpawnRequest request;
+        spawn_request_init(&request, argv);
+
+        request.path = path;
+        memcpy(request.fds, fds, sizeof(fds));
+
+        job->pid = spawn_process(&request);
+    }
+
+    if (job->pid == -1) {
+        job->pid = 0;
+        report_spawn_error(argv[0]);
+        return 0;
+    }
+
+    job->pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+    job->command = join_words(argv);
+
+    return 1;
+}
+
+static void flush_output(int fd, int target) {
+    /*
+     * Writes out everything a job wrote to one of its memfds, and empties it for the next job
+     */
+
+    off_t length = lseek(fd, 0, SEEK_CUR);
+
+    if (length > 0) {
+        lseek(fd, 0, SEEK_SET);
+        copy_fd(fd, target);
+    }
+
+    ftruncate(fd, 0);
+    lseek(fd, 0, SEEK_SET);
+}
+
+static int wait_job(ParallelJob* jobs, int slots, struct pollfd* pollfds, int* status) {
+    /*
+     * Waits for any of the running jobs to exit. Only our own children are waited for, so
+     * background jobs exiting meanwhile are still reaped and reported by the shell
+     *
+     * Arguments:
+     *  pollfds: Room for one entry per slot
+     *
+     * Returns: The slot of the job that exited, with its wait status in status
+     */
+
+    while (1) {
+        int watched = 0;
+        int unwatched = 0;
+
+        for (int i = 0; i < slots; i++) {
+            if (jobs[i].pid == 0)
+                continue;
+
+            if (jobs[i].pidfd == -1)
+                unwatched = 1;
+            else {
+                pollfds[watched].fd = jobs[i].pidfd;
+                pollfds[watched].events = POLLIN;
+                watched++;
+            }
+        }
+
+        // Without pidfds, checking every few milliseconds is all we can do
+        poll(pollfds, watched, unwatched ? 10 : -1);
+
+        for (int i = 0; i < slots; i++) {
+            if (jobs[i].pid != 0 && waitpid(jobs[i].pid, status, WNOHANG) == jobs[i].pid)
+                return i;
+        }
+    }
+}
+
+static void print_parallel_usage() {
+    fprintf(stderr, "usage: parallel [-j jobs] command [args] [::: words]\n\n");
+    fprintf(stderr, "  Runs the command once for every word, with up to jobs of them running at once\n");
+    fprintf(stderr, "  (default: the number of CPUs). The word replaces every '{}' in the arguments, or\n");
+    fprintf(stderr, "  is appended if there's none. Without ':::' the words are the lines of stdin.\n");
+    fprintf(stderr, "  Each job's output is written out in one piece once it exits, and the exit status\n");
+    fprintf(stderr, "  is the number of jobs that failed\n\n");
+    fprintf(stderr, "  -j jobs    how many jobs to run at once\n");
+}
+
+static int read_slots(const char* arg, int* slots) {
+    char* end;
+    long value = strtol(arg, &end, 10);
+
+    if (*end != '\0' || end == arg || value < 1 || value > INT_MAX)
+        return 0;
+
+    *slots = value;
+
+    return 1;
+}
+
+int builtin_parallel(int argc, char** argv) {
+    int slots = 0;
+    int first = 1;
+
+    for (; first < argc; first++) {
+        if (strcmp(argv[first], "-h") == 0) {
+            print_parallel_usage();
+            return 0;
+        }
+        else if (strcmp(argv[first], "-j") == 0 && first + 1 < argc) {
+            if (!read_slots(argv[++first], &slots)) {
+                fprintf(stderr, "%serror%s: parallel: not a number of jobs: %s\n", colors[ERR_COLOR], color_reset, argv[first]);
+                return 2;
+            }
+        }
+        else
+            break;
+    }
+
+    char** words;
+    int command_argc = arg_source_split(argc - first, argv + first, &words);
+
+    if (command_argc == 0) {
+        print_parallel_usage();
+        return 2;
+    }
+
+    char** command = argv + first;
+
+    if (slots == 0)
+        slots = cpu_count();
+
+    // The command is looked up once for all the jobs
+    Builtin* builtin = find_builtin(command[0]);
+    char* path = NULL;
+
+    if (builtin == NULL && (path = path_lookup(command[0])) == NULL) {
+        report_command_not_found(command[0]);
+        return 127;
+    }
+
+    int placeholder = 0;
+    for (int i = 1; i < command_argc; i++) {
+        if (strstr(command[i], "{}") != NULL)
+            placeholder = 1;
+    }
+
+    ArgSource source;
+    if (!arg_source_init(&source, words)) {
+        fprintf(stderr, "%serror%s: parallel: can't read stdin\n", colors[ERR_COLOR], color_reset);
+        return 1;
+    }
+
+    // When the words come from stdin, the jobs mustn't read it too
+    int in_fd = -1;
+    if (words == NULL)
+        in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    ParallelJob* jobs = calloc(slots, sizeof(ParallelJob));
+    struct pollfd* pollfds = malloc(sizeof(struct pollfd) * slots);
+
+    int buffered = 0;
+
+    for (; buffered < slots; buffered++) {
+        jobs[buffered].out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+        jobs[buffered].err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+
+        if (jobs[buffered].out_fd == -1 || jobs[buffered].err_fd == -1)
+            break;
+    }
+
+    // Out of descriptors: a job without its buffers would write straight to the terminal, so
+    // fewer run at once, leaving a third of what was allocated for their pidfds and spawning
+    if (buffered < slots) {
+        int usable = buffered * 2 / 3;
+
+        for (int i = usable; i <= buffered; i++) {
+            if (jobs[i].out_fd != -1)
+                close(jobs[i].out_fd);
+            if (jobs[i].err_fd != -1)
+                close(jobs[i].err_fd);
+        }
+
+        if (usable == 0) {
+            fprintf(stderr, "%serror%s: parallel: can't buffer the output of a job: %s\n", colors[ERR_COLOR], color_reset,
+                    strerror(errno));
+            free(jobs);
+            free(pollfds);
+            arg_source_close(&source);
+
+            if (in_fd != -1)
+                close(in_fd);
+
+            return 1;
+        }
+
+        fprintf(stderr, "parallel: only enough file descriptors to run %d jobs at once\n", usable);
+        slots = usable;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    int running = 0;
+    int started = 0;
+    int failed = 0;
+    int stopped = 0;
+
+    while (1) {
+        // Fill every free slot
+        while (!stopped && running < slots) {
+            char* word = arg_source_next(&source);
+
+            if (word == NULL) {
+                stopped = 1;
+                break;
+            }
+
+            int slot = 0;
+            while (jobs[slot].pid != 0)
+                slot++;
+
+            char** job = job_argv(command, command_argc, word, placeholder);
+            started++;
+
+            if (start_job(&jobs[slot], job, path, builtin, in_fd))
+                running++;
+            else {
+                failed++;
+                stopped = 1;
+            }
+
+            for (int i = 0; job[i] != NULL; i++)
+                free(job[i]);
+            free(job);
+        }
+
+        if (running == 0)
+            break;
+
+        int status;
+        ParallelJob* job = &jobs[wait_job(jobs, slots, pollfds, &status)];
+
+        flush_output(job->out_fd, STDOUT_FILENO);
+        flush_output(job->err_fd, STDERR_FILENO);
+
+        if (status != 0) {
+            fprintf(stderr, "%serror%s: parallel: exit %d: %s\n", colors[ERR_COLOR], color_reset,
+                    exit_status(status), job->command);
+            failed++;
+
+            // Ctrl-C reaches the jobs, which should be the end of it
+            if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+                stopped = 1;
+        }
+
+        if (job->pidfd != -1)
+            close(job->pidfd);
+
+        free(job->command);
+        job->command = NULL;
+        job->pid = 0;
+        running--;
+    }
+
+    if (failed > 0)
+        fprintf(stderr, "%serror%s: parallel: %d of %d jobs failed\n", colors[ERR_COLOR], color_reset, failed, started);
+
+    for (int i = 0; i < slots; i++) {
+        close(jobs[i].out_fd);
+        close(jobs[i].err_fd);
+    }
+
+    free(jobs);
+    free(pollfds);
+    arg_source_close(&source);
+
+    if (in_fd != -1)
+        close(in_fd);
+
+    return failed > PARALLEL_MAX_FAILED_STATUS ? PARALLEL_MAX_FAILED_STATUS : failed;
+}
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <unistd.h>
+
+// GNU parallel's convention: the exit status is the number of failed jobs, up to this
+#define PARALLEL_MAX_FAILED_STATUS 101
+
+// One of the job slots. Output goes to the slot's memfds and is written out in one piece
+// once the job exits, so the output of different jobs never interleaves
+typedef struct ParallelJob {
+    pid_t pid;          // 0 while the slot is free
+    int pidfd;          // -1 if pidfds aren't supported
+    int out_fd;
+    int err_fd;
+    char* command;      // for the failure report
+} ParallelJob;
+
+int builtin_parallel(int argc, char** argv);
+
+#endif
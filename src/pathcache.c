@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+
+#include "globals.h"
+
+static PathCache cache;
+
+unsigned long hash_string(const char* str) {
+    /*
+     * FNV-1a hash of a string
+     */
+
+    unsigned long hash = 14695981039346656037UL;
+
+    while (*str) {
+        hash ^= (unsigned char) *str++;
+        hash *= 1099511628211UL;
+    }
+
+    return hash;
+}
+
+static void free_entry(PathEntry* entry) {
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
+
+static void drop_entries(int from_dir) {
+    /*
+     * Drops every cached command found in the PATH directory at from_dir or after it,
+     * since a change in that directory can remove them or shadow them
+     */
+
+    for (int i = 0; i < cache.buckets_num; i++) {
+        PathEntry** link = &cache.buckets[i];
+
+        while (*link != NULL) {
+            PathEntry* entry = *link;
+
+            if (entry->dir_index >= from_dir) {
+                *link = entry->next;
+                free_entry(entry);
+                cache.entries_num--;
+            }
+            else
+                link = &entry->next;
+        }
+    }
+}
+
+static void load_path(const char* path_env) {
+    /*
+     * Splits PATH into its directories, forgetting everything cached from the old PATH
+     */
+
+    drop_entries(0);
+
+    for (int i = 0; i < cache.dirs_num; i++)
+        free(cache.dirs[i].name);
+    free(cache.dirs);
+    free(cache.path_env);
+
+    cache.path_env = strdup(path_env);
+
+    cache.dirs_num = 1;
+    for (const char* c = path_env; *c; c++) {
+        if (*c == ':')
+            cache.dirs_num++;
+    }
+
+    cache.dirs = malloc(sizeof(PathDir) * cache.dirs_num);
+
+    const char* start = path_env;
+    for (int i = 0; i < cache.dirs_num; i++) {
+        const char* end = strchr(start, ':');
+        size_t len = (end != NULL) ? (size_t) (end - start) : strlen(start);
+
+        // An empty entry means the current directory
+        cache.dirs[i].name = (len == 0) ? strdup(".") : strndup(start, len);
+        cache.dirs[i].mtime_known = 0;
+
+        start = end + 1;
+    }
+}
+
+static int dir_unchanged(int i) {
+    /*
+     * Checks the mtime of a PATH directory against the one recorded when it was searched
+     *
+     * Returns: 1 if the directory is unchanged, 0 if it changed (and records the new mtime)
+     */
+
+    struct stat st;
+    PathDir* dir = &cache.dirs[i];
+
+    if (stat(dir->name, &st) == -1) {
+        st.st_mtim.tv_sec = 0;
+        st.st_mtim.tv_nsec = 0;
+    }
+
+    int unchanged = dir->mtime_known && st.st_mtim.tv_sec == dir->mtime.tv_sec && st.st_mtim.tv_nsec == dir->mtime.tv_nsec;
+
+    dir->mtime = st.st_mtim;
+    dir->mtime_known = 1;
+
+    return unchanged;
+}
+
+static void insert_entry(const char* name, char* path, int dir_index) {
+    // Keep chains short by doubling the table when it gets full
+    if (cache.entries_num >= cache.buckets_num) {
+        int buckets_num = (cache.buckets_num == 0) ? PATH_CACHE_INITIAL_BUCKETS : cache.buckets_num * 2;
+        PathEntry** buckets = calloc(buckets_num, sizeof(PathEntry*));
+
+        for (int i = 0; i < cache.buckets_num; i++) {
+            PathEntry* entry = cache.buckets[i];
+
+            while (entry != NULL) {
+                PathEntry* next = entry->next;
+                unsigned long b = hash_string(entry->name) % buckets_num;
+
+                entry->next = buckets[b];
+                buckets[b] = entry;
+                entry = next;
+            }
+        }
+
+        free(cache.buckets);
+        cache.buckets = buckets;
+        cache.buckets_num = buckets_num;
+    }
+
+    PathEntry* entry = malloc(sizeof(PathEntry));
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->dir_index = dir_index;
+    entry->hits = 1;
+
+    unsigned long b = hash_string(name) % cache.buckets_num;
+    entry->next = cache.buckets[b];
+    cache.buckets[b] = entry;
+
+    cache.entries_num++;
+}
+
+char* path_lookup(const char* name) {
+    /*
+     * Resolves a command name to the executable that execvp() would run, the way execvp()
+     * would, but remembers the result
+     *
+     * Arguments:
+     *  name: The command name
+     *
+     * Returns: The path of the executable, owned by the cache and valid until the next lookup.
+     *          NULL if the command isn't found
+     */
+
+    // Paths are never looked up
+    if (strchr(name, '/') != NULL)
+        return (char*) name;
+
+    const char* path_env = getenv("PATH");
+    if (path_env == NULL)
+        path_env = DEFAULT_PATH;
+
+    if (cache.path_env == NULL || strcmp(cache.path_env, path_env) != 0)
+        load_path(path_env);
+
+    if (cache.buckets_num > 0) {
+        PathEntry* entry = cache.buckets[hash_string(name) % cache.buckets_num];
+
+        while (entry != NULL && strcmp(entry->name, name) != 0)
+            entry = entry->next;
+
+        if (entry != NULL) {
+            // Still valid if neither its own directory nor one before it changed
+            int changed_dir = -1;
+
+            for (int i = 0; i <= entry->dir_index; i++) {
+                if (!dir_unchanged(i) && changed_dir == -1)
+                    changed_dir = i;
+            }
+
+            if (changed_dir == -1) {
+                entry->hits++;
+                return entry->path;
+            }
+
+            drop_entries(changed_dir);
+        }
+    }
+
+    // Search PATH in order
+    size_t name_len = strlen(name);
+
+    for (int i = 0; i < cache.dirs_num; i++) {
+        PathDir* dir = &cache.dirs[i];
+
+        if (!dir->mtime_known)
+            dir_unchanged(i);
+
+        size_t dir_len = strlen(dir->name);
+        char* path = malloc(dir_len + name_len + 2);
+        memcpy(path, dir->name, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, name, name_len + 1);
+
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+            // Relative PATH entries depend on the current directory, so they aren't cached
+            if (dir->name[0] != '/') {
+                static char* uncached = NULL;
+                free(uncached);
+                uncached = path;
+                return path;
+            }
+
+            insert_entry(name, path, i);
+            return path;
+        }
+
+        free(path);
+    }
+
+    return NULL;
+}
+
+void path_cache_clear() {
+    /*
+     * Forgets every remembered command location
+     */
+
+    drop_entries(0);
+
+    for (int i = 0; i < cache.dirs_num; i++)
+        cache.dirs[i].mtime_known = 0;
+}
+
+void path_cache_print() {
+    /*
+     * Prints the remembered commands in the format of other shells' hash builtin
+     */
+
+    if (cache.entries_num == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+
+    printf("hits\tcommand\n");
+
+    for (int i = 0; i < cache.buckets_num; i++) {
+        for (PathEntry* entry = cache.buckets[i]; entry != NULL; entry = entry->next)
+            printf("%4d\t%s\n", entry->hits, entry->path);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <time.h>
+
+#define PATH_CACHE_INITIAL_BUCKETS 64
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+typedef struct PathEntry {
+    char* name;
+    char* path;
+    int dir_index;      // position in PATH of the directory the command was found in
+    int hits;
+    struct PathEntry* next;
+} PathEntry;
+
+typedef struct PathDir {
+    char* name;
+    struct timespec mtime;
+    int mtime_known;
+} PathDir;
+
+// Hash table from command names to the absolute paths they resolve to
+typedef struct PathCache {
+    PathEntry** buckets;
+    int buckets_num;
+    int entries_num;
+
+    char* path_env;     // the PATH the cache was filled from
+    PathDir* dirs;
+    int dirs_num;
+} PathCache;
+
+char* path_lookup(const char* name);
+void path_cache_clear();
+void path_cache_print();
+
+unsigned long hash_string(const char* str);
+
+#endif
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+
+#include "pipeline.h"
+
+#include "globals.h"
+
+// How the pipes and stages of a pipeline are set up
+typedef struct PipelineSettings {
+    long pipe_size;         // bytes, 0 for the kernel's default
+    cpu_set_t cpus;         // the CPUs stages are pinned to in turn, none to let them float
+    int siblings;           // fill the SMT siblings of a core before moving to the next one
+} PipelineSettings;
+
+static PipelineSettings settings;
+
+// What the settings go back to after a line that changed them for itself
+static PipelineSettings global;
+static int scoped = 0;
+
+static long read_max_size() {
+    /*
+     * Returns: The largest pipe an unprivileged process may ask for, 0 if it's unknown
+     */
+
+    FILE* file = fopen(PIPELINE_MAX_SIZE_FILE, "r");
+    long max = 0;
+
+    if (file != NULL) {
+        if (fscanf(file, "%ld", &max) != 1)
+            max = 0;
+        fclose(file);
+    }
+
+    return max;
+}
+
+static int parse_cpu_list(const char* list, cpu_set_t* set) {
+    /*
+     * Reads a CPU list in the kernel's format, like "0-3,8,10-11"
+     *
+     * Returns: 1 on success, 0 if it isn't one
+     */
+
+    CPU_ZERO(set);
+
+    const char* p = list;
+
+    while (*p != '\0' && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p || first < 0)
+            return 0;
+
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+
+            if (end == p || last < first)
+                return 0;
+        }
+
+        if (last >= CPU_SETSIZE)
+            return 0;
+
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+
+        p = end;
+
+        if (*p == ',')
+            p++;
+        else if (*p != '\0' && *p != '\n')
+            return 0;
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+static void print_cpu_list(const cpu_set_t* set) {
+    const char* separator = "";
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+
+        if (last > cpu)
+            printf("%s%d-%d", separator, cpu, last);
+        else
+            printf("%s%d", separator, cpu);
+
+        separator = ",";
+        cpu = last;
+    }
+}
+
+int pipeline_set_pipe_size(const char* text) {
+    /*
+     * Sets the capacity of the pipes between stages, in bytes or with a K, M or G suffix,
+     * 0 for the kernel's default. More than pipe-max-size is cut down to it, since the
+     * kernel would refuse it
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    char* end;
+    long size = strtol(text, &end, 10);
+
+    switch (toupper(*end)) {
+        case 'G': size <<= 10;      // fall through
+        case 'M': size <<= 10;      // fall through
+        case 'K': size <<= 10; end++; break;
+    }
+
+    if (*end != '\0' || end == text || size < 0) {
+        fprintf(stderr, "%serror%s: pipeline: not a pipe size: %s\n", colors[ERR_COLOR], color_reset, text);
+        return 0;
+    }
+
+    long max = read_max_size();
+
+    if (max > 0 && size > max) {
+        fprintf(stderr, "pipeline: %s is over %s, using %ld\n", text, PIPELINE_MAX_SIZE_FILE, max);
+        size = max;
+    }
+
+    settings.pipe_size = size;
+
+    return 1;
+}
+
+int pipeline_set_cpus(const char* list, int siblings) {
+    /*
+     * Sets the CPUs stages are pinned to, "off" to let them run anywhere
+     *
+     * Arguments:
+     *  list: A CPU list, like "0-3,8"
+     *  siblings: Whether neighbouring stages go on the SMT siblings of a core first
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    if (strcmp(list, "off") == 0) {
+        CPU_ZERO(&settings.cpus);
+        settings.siblings = 0;
+        return 1;
+    }
+
+    cpu_set_t set, allowed;
+
+    if (!parse_cpu_list(list, &set)) {
+        fprintf(stderr, "%serror%s: pipeline: not a CPU list: %s\n", colors[ERR_COLOR], color_reset, list);
+        return 0;
+    }
+
+    // Pinning a stage to a CPU it may not use would fail after it has started
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set) && !CPU_ISSET(cpu, &allowed)) {
+                fprintf(stderr, "%serror%s: pipeline: CPU %d isn't available\n", colors[ERR_COLOR], color_reset, cpu);
+                return 0;
+            }
+        }
+    }
+
+    settings.cpus = set;
+    settings.siblings = siblings;
+
+    return 1;
+}
+
+void pipeline_tune_pipe(int fd) {
+    // A pipe over the user's pipe-user-pages-soft quota is refused, and just keeps its size
+    if (settings.pipe_size > 0)
+        fcntl(fd, F_SETPIPE_SZ, settings.pipe_size);
+}
+
+int* pipeline_cpu_order(int* count) {
+    /*
+     * Lists the CPUs in the order stages are pinned to them. With siblings, every SMT sibling
+     * of a core comes before the next core, so neighbouring stages, which hand data to each
+     * other, share that core's caches
+     *
+     * Returns: The CPUs, allocated from line_arena, with how many there are in count, or
+     *          NULL and 0 if stages aren't pinned
+     */
+
+    *count = CPU_COUNT(&settings.cpus);
+
+    if (*count == 0)
+        return NULL;
+
+    int* order = arena_alloc(&line_arena, sizeof(int) * *count);
+    cpu_set_t placed;
+    CPU_ZERO(&placed);
+
+    int n = 0;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < *count; cpu++) {
+        if (!CPU_ISSET(cpu, &settings.cpus) || CPU_ISSET(cpu, &placed))
+            continue;
+
+        order[n++] = cpu;
+        CPU_SET(cpu, &placed);
+
+        if (!settings.siblings)
+            continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), PIPELINE_SIBLINGS_FILE, cpu);
+
+        FILE* file = fopen(path, "r");
+        if (file == NULL)
+            continue;
+
+        char line[256];
+        cpu_set_t siblings;
+
+        if (fgets(line, sizeof(line), file) != NULL && parse_cpu_list(line, &siblings)) {
+            for (int sibling = 0; sibling < CPU_SETSIZE && n < *count; sibling++) {
+                if (CPU_ISSET(sibling, &siblings) && CPU_ISSET(sibling, &settings.cpus) && !CPU_ISSET(sibling, &placed)) {
+                    order[n++] = sibling;
+                    CPU_SET(sibling, &placed);
+                }
+            }
+        }
+
+        fclose(file);
+    }
+
+    return order;
+}
+
+void pipeline_pin_stage(pid_t pid, int stage, const int* order, int count) {
+    /*
+     * Pins a stage to its CPU, going round the list when there are more stages than CPUs.
+     * It's done from the shell once the stage has started, which works with every spawn
+     * backend, and is in place before the command gets far
+     */
+
+    if (count == 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(order[stage % count], &set);
+
+    // The stage may be gone already
+    sched_setaffinity(pid, sizeof(set), &set);
+}
+
+static void print_settings() {
+    long max = read_max_size();
+
+    if (settings.pipe_size > 0)
+        printf("pipe size: %ld", settings.pipe_size);
+    else
+        printf("pipe size: the kernel's default");
+
+    if (max > 0)
+        printf(", at most %ld\n", max);
+    else
+        printf("\n");
+
+    if (CPU_COUNT(&settings.cpus) == 0) {
+        printf("cpus: any\n");
+        return;
+    }
+
+    printf("cpus: ");
+    print_cpu_list(&settings.cpus);
+    printf("%s\n", settings.siblings ? ", neighbouring stages on the SMT siblings of a core" : ", one stage after another");
+}
+
+static void print_pipeline_usage() {
+    fprintf(stderr, "usage: pipeline [-s size] [-c cpus [-S]] [command | command ...]\n\n");
+    fprintf(stderr, "  Sets how the pipes and stages of pipelines are set up. Followed by a command, only\n");
+    fprintf(stderr, "  for that command, otherwise from now on. On its own, shows the settings\n\n");
+    fprintf(stderr, "  -s size   the capacity of every pipe, like 1M, up to %s. 0 for the default\n", PIPELINE_MAX_SIZE_FILE);
+    fprintf(stderr, "  -c cpus   pin the stages to these CPUs in turn, like 0-3,8. off to let them float\n");
+    fprintf(stderr, "  -S        put neighbouring stages on the SMT siblings of a core first\n");
+}
+
+int pipeline_configure(char** input) {
+    /*
+     * Applies the options after a leading "pipeline". Followed by a command they only last
+     * until pipeline_end_line(), otherwise they're kept
+     *
+     * Arguments:
+     *  input: The parsed line, starting with "pipeline"
+     *
+     * Returns: The number of words the options took, "pipeline" included, or -1 on an error
+     */
+
+    char* size = NULL;
+    char* cpus = NULL;
+    int siblings = 0;
+
+    int first = 1;
+
+    for (; input[first] != NULL && input[first][0] == '-'; first++) {
+        if (strcmp(input[first], "-S") == 0)
+            siblings = 1;
+        else if (strcmp(input[first], "-s") == 0 && input[first + 1] != NULL)
+            size = input[++first];
+        else if (strcmp(input[first], "-c") == 0 && input[first + 1] != NULL)
+            cpus = input[++first];
+        else {
+            print_pipeline_usage();
+            return -1;
+        }
+    }
+
+    if (first == 1 && input[first] == NULL) {
+        print_settings();
+        return first;
+    }
+
+    if (input[first] != NULL) {
+        global = settings;
+        scoped = 1;
+    }
+
+    int ok = 1;
+
+    if (size != NULL)
+        ok = pipeline_set_pipe_size(size);
+
+    if (ok && cpus != NULL)
+        ok = pipeline_set_cpus(cpus, siblings);
+    else if (ok && siblings)
+        settings.siblings = 1;
+
+    if (!ok) {
+        pipeline_end_line();
+        return -1;
+    }
+
+    return first;
+}
+
+void pipeline_end_line() {
+    if (scoped) {
+        settings = global;
+        scoped = 0;
+    }
+}
+
+int builtin_pipeline(int argc, char** argv) {
+    // Only reached when "pipeline" isn't the first word of the line, where execute_line() handles it
+    print_pipeline_usage();
+
+    return 2;
+}
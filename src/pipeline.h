@@ -0,0 +1,20 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <unistd.h>
+
+#define PIPELINE_MAX_SIZE_FILE "/proc/sys/fs/pipe-max-size"
+#define PIPELINE_SIBLINGS_FILE "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list"
+
+int pipeline_configure(char** input);
+void pipeline_end_line();
+int pipeline_set_pipe_size(const char* size);
+int pipeline_set_cpus(const char* list, int siblings);
+
+void pipeline_tune_pipe(int fd);
+int* pipeline_cpu_order(int* count);
+void pipeline_pin_stage(pid_t pid, int stage, const int* order, int count);
+
+int builtin_pipeline(int argc, char** argv);
+
+#endif
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+
+#include "profile.h"
+#include "usage.h"
+#include "pipeline.h"
+
+#include "globals.h"
+
+int pipeline_profiling = 0;
+
+static long long now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+PipeProfile* profile_begin(int stages) {
+    /*
+     * Returns: A profile with room for the links between the stages, allocated from line_arena
+     */
+
+    PipeProfile* profile = arena_alloc(&line_arena, sizeof(PipeProfile));
+
+    profile->links = arena_alloc(&line_arena, sizeof(PipeLink) * (stages > 1 ? stages - 1 : 1));
+    profile->links_num = 0;
+    profile->relay_ns = 0;
+
+    return profile;
+}
+
+int profile_link_open(PipeProfile* profile, int link, int* upstream_write, int* downstream_read) {
+    /*
+     * Creates the two pipes of a link. The shell's ends are non-blocking, which doesn't
+     * affect the stages, since each end of a pipe is a separate open file
+     *
+     * Arguments:
+     *  link: The index of the upstream stage
+     *  upstream_write, downstream_read: Set to the ends the stages get
+     *
+     * Returns: 1 on success, 0 otherwise
+     */
+
+    int upstream[2], downstream[2];
+
+    if (pipe2(upstream, O_CLOEXEC) == -1)
+        return 0;
+
+    if (pipe2(downstream, O_CLOEXEC) == -1) {
+        close(upstream[0]);
+        close(upstream[1]);
+        return 0;
+    }
+
+    pipeline_tune_pipe(upstream[1]);
+    pipeline_tune_pipe(downstream[1]);
+
+    fcntl(upstream[0], F_SETFL, O_NONBLOCK);
+    fcntl(downstream[1], F_SETFL, O_NONBLOCK);
+
+    PipeLink* pipe_link = &profile->links[link];
+    memset(pipe_link, 0, sizeof(PipeLink));
+
+    pipe_link->source = upstream[0];
+    pipe_link->target = downstream[1];
+
+    *upstream_write = upstream[1];
+    *downstream_read = downstream[0];
+
+    profile->links_num = link + 1;
+
+    return 1;
+}
+
+static void link_close(PipeLink* link) {
+    close(link->source);
+    close(link->target);
+    link->source = -1;
+}
+
+static int link_splice(PipeLink* link) {
+    /*
+     * Moves whatever the link's source has into its target, without copying it to user space
+     *
+     * Returns: 1 while the link is open, 0 once it's done
+     */
+
+    for (int i = 0; i < PROFILE_SPLICES_PER_TURN; i++) {
+        ssize_t moved = splice(link->source, NULL, link->target, NULL, PROFILE_SPLICE_SIZE,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (moved > 0) {
+            link->bytes += moved;
+            continue;
+        }
+
+        // The upstream stage closed its stdout, or the downstream stage closed its stdin.
+        // Closing our ends passes either on, as an EOF or a SIGPIPE
+        if (moved == 0 || errno != EAGAIN) {
+            link_close(link);
+            return 0;
+        }
+
+        // Either side could be why nothing moved
+        struct pollfd check[2] = {
+            { .fd = link->source, .events = POLLIN },
+            { .fd = link->target, .events = POLLOUT },
+        };
+        poll(check, 2, 0);
+
+        link->full = (check[0].revents & POLLIN) && !(check[1].revents & POLLOUT);
+
+        return 1;
+    }
+
+    // There's more, but the other links get their turn first
+    link->full = 0;
+
+    return 1;
+}
+
+void profile_relay(PipeProfile* profile) {
+    /*
+     * Moves the data of every link until all the stages are done with their pipes. Each link
+     * is waiting either for its upstream stage to write, or for its downstream stage to read,
+     * and the time it spends waiting is charged to that side
+     */
+
+    // A stage that exits early must not take the shell with it
+    struct sigaction ignore = { .sa_handler = SIG_IGN }, saved;
+    sigaction(SIGPIPE, &ignore, &saved);
+
+    struct pollfd* pollfds = malloc(sizeof(struct pollfd) * profile->links_num);
+    int* polled = malloc(sizeof(int) * profile->links_num);
+
+    long long start = now_ns();
+
+    while (1) {
+        int n = 0;
+
+        for (int i = 0; i < profile->links_num; i++) {
+            PipeLink* link = &profile->links[i];
+
+            if (link->source == -1)
+                continue;
+
+            pollfds[n].fd = link->full ? link->target : link->source;
+            pollfds[n].events = link->full ? POLLOUT : POLLIN;
+            polled[n] = i;
+            n++;
+        }
+
+        if (n == 0)
+            break;
+
+        long long before = now_ns();
+
+        if (poll(pollfds, n, -1) == -1 && errno != EINTR)
+            break;
+
+        long long waited = now_ns() - before;
+
+        for (int i = 0; i < n; i++) {
+            PipeLink* link = &profile->links[polled[i]];
+
+            if (link->full)
+                link->full_ns += waited;
+            else
+                link->empty_ns += waited;
+
+            if (pollfds[i].revents != 0)
+                link_splice(link);
+        }
+    }
+
+    profile->relay_ns = now_ns() - start;
+
+    // Whatever is left open after an error is closed, so the stages still see the end
+    for (int i = 0; i < profile->links_num; i++) {
+        if (profile->links[i].source != -1)
+            link_close(&profile->links[i]);
+    }
+
+    free(pollfds);
+    free(polled);
+
+    sigaction(SIGPIPE, &saved, NULL);
+}
+
+static void format_size(long long bytes, char* buffer, size_t size) {
+    const char* units = "BKMGT";
+    double value = bytes;
+    int unit = 0;
+
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+
+    if (unit == 0)
+        snprintf(buffer, size, "%lldB", bytes);
+    else
+        snprintf(buffer, size, "%.1f%c", value, units[unit]);
+}
+
+static double share(long long ns, long long total) {
+    return total > 0 ? 100.0 * ns / total : 0;
+}
+
+void profile_print(PipeProfile* profile) {
+    /*
+     * Prints what went through each stage, and how much of the time it was starved of input
+     * or blocked on its output. The stage the others spent the most time waiting for is the
+     * bottleneck: data piles up in front of it, and the stages after it run dry
+     */
+
+    int stages = line_usage.stages_num;
+    PipeLink* links = profile->links;
+
+    fprintf(stderr, "stage  %-16s %8s %8s %9s %5s %8s %8s\n", "command", "in", "out", "MB/s", "cpu", "starved", "blocked");
+
+    int bottleneck = -1;
+    double bottleneck_score = 0;
+
+    for (int i = 0; i < stages; i++) {
+        StageUsage* stage = &line_usage.stages[i];
+        PipeLink* in = (i > 0 && i - 1 < profile->links_num) ? &links[i - 1] : NULL;
+        PipeLink* out = (i < profile->links_num) ? &links[i] : NULL;
+
+        char in_size[16] = "-", out_size[16] = "-";
+        if (in != NULL)
+            format_size(in->bytes, in_size, sizeof(in_size));
+        if (out != NULL)
+            format_size(out->bytes, out_size, sizeof(out_size));
+
+        double wall = (stage->end.tv_sec - stage->start.tv_sec) + (stage->end.tv_nsec - stage->start.tv_nsec) / 1e9;
+        double cpu = usage_seconds(&stage->usage.ru_utime) + usage_seconds(&stage->usage.ru_stime);
+        long long bytes = (in != NULL) ? in->bytes : (out != NULL ? out->bytes : 0);
+
+        char rate[16] = "-", load[16] = "-";
+        if (stage->status != -1 && wall > 0) {
+            snprintf(rate, sizeof(rate), "%.1f", bytes / wall / (1024 * 1024));
+            snprintf(load, sizeof(load), "%.0f%%", 100 * cpu / wall);
+        }
+
+        char starved[16] = "-", blocked[16] = "-";
+        if (in != NULL)
+            snprintf(starved, sizeof(starved), "%.1f%%", share(in->empty_ns, profile->relay_ns));
+        if (out != NULL)
+            snprintf(blocked, sizeof(blocked), "%.1f%%", share(out->full_ns, profile->relay_ns));
+
+        fprintf(stderr, "%5d  %-16.16s %8s %8s %9s %5s %8s %8s\n", i + 1, stage->command != NULL ? stage->command : "",
+                in_size, out_size, rate, load, starved, blocked);
+
+        // How long the stages around it waited for this one
+        double score = 0;
+        if (in != NULL)
+            score += share(in->full_ns, profile->relay_ns);
+        if (out != NULL)
+            score += share(out->empty_ns, profile->relay_ns);
+
+        if (score > bottleneck_score) {
+            bottleneck_score = score;
+            bottleneck = i;
+        }
+    }
+
+    if (bottleneck != -1)
+        fprintf(stderr, "bottleneck: stage %d (%s)\n", bottleneck + 1, line_usage.stages[bottleneck].command);
+}
+
+void profile_print_usage() {
+    fprintf(stderr, "usage: profile command | command [| command ...]\n\n");
+    fprintf(stderr, "  Runs a pipeline with every pipe relayed through the shell with splice(), and prints\n");
+    fprintf(stderr, "  how much went through each stage, how fast, and how much of the time each stage was\n");
+    fprintf(stderr, "  starved of input or blocked on its output, then which stage held the others back\n");
+}
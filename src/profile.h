@@ -0,0 +1,37 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// The most a single splice() moves between two pipes
+#define PROFILE_SPLICE_SIZE (1 << 20)
+
+// Splices per link before the other links get a turn
+#define PROFILE_SPLICES_PER_TURN 16
+
+// The pipe between two stages, relayed through the shell: the upstream stage writes into
+// one pipe, the shell splices what it reads into a second one, which the downstream stage reads
+typedef struct PipeLink {
+    int source;             // read end of the upstream stage's pipe, -1 once it's done
+    int target;             // write end of the downstream stage's pipe
+    int full;               // the last splice stopped because the target was full
+
+    long long bytes;
+    long long empty_ns;     // waiting for the upstream stage to write
+    long long full_ns;      // waiting for the downstream stage to read
+} PipeLink;
+
+typedef struct PipeProfile {
+    PipeLink* links;
+    int links_num;
+    long long relay_ns;     // how long the relay ran, which the stall times are a share of
+} PipeProfile;
+
+// Set while a line that starts with "profile" runs
+extern int pipeline_profiling;
+
+PipeProfile* profile_begin(int stages);
+int profile_link_open(PipeProfile* profile, int link, int* upstream_write, int* downstream_read);
+void profile_relay(PipeProfile* profile);
+void profile_print(PipeProfile* profile);
+void profile_print_usage();
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include <readline/readline.h>
+
+#include "prompt.h"
+
+#include "globals.h"
+
+// Box drawing character of the filler line, 3 bytes in UTF-8
+#define FILLER_CHAR "─"
+#define FILLER_CHAR_LEN 3
+
+static PromptCache cache = { .stale = PROMPT_ALL, .color = -1 };
+
+void prompt_invalidate(int pieces) {
+    /*
+     * Marks pieces of the prompt to be rebuilt on the next render
+     *
+     * Arguments:
+     *  pieces: PROMPT_WIDTH after a resize, PROMPT_DIR after a directory change,
+     *          PROMPT_COLOR after an accent color change
+     */
+
+    cache.stale |= pieces;
+}
+
+static void update_width() {
+    struct winsize w;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1)
+        w.ws_col = 0;
+
+    cache.width = w.ws_col;
+}
+
+static void update_dir() {
+    if (getcwd(cache.dir, sizeof(cache.dir)) == NULL)
+        strcpy(cache.dir, "?");
+
+    char* home = getenv("HOME");
+
+    if (home != NULL && strcmp(cache.dir, home) == 0)
+        strcpy(cache.dir, "~");
+
+    // truncate the last two directories by default
+    truncate_dir(cache.dir, 2);
+}
+
+static void update_filler_line() {
+    // note: 7 is the other decorative characters
+    int length = cache.width - (int) (strlen(username) + strlen(hostname) + strlen(cache.dir) + 7);
+
+    if (length < 0)
+        length = 0;
+
+    size_t size = (size_t) length * FILLER_CHAR_LEN + 1;
+
+    if (size > cache.filler_capacity) {
+        cache.filler_line = realloc(cache.filler_line, size);
+        cache.filler_capacity = size;
+    }
+
+    // Fill it by doubling what's already there, instead of appending one character at a time
+    size_t filled = 0;
+    size_t total = size - 1;
+
+    if (total > 0) {
+        memcpy(cache.filler_line, FILLER_CHAR, FILLER_CHAR_LEN);
+        filled = FILLER_CHAR_LEN;
+    }
+
+    while (filled < total) {
+        size_t chunk = (filled < total - filled) ? filled : total - filled;
+        memcpy(cache.filler_line + filled, cache.filler_line, chunk);
+        filled += chunk;
+    }
+
+    cache.filler_line[total] = '\0';
+}
+
+static void render() {
+    const char* accent = colors[cache.color];
+    // The last line is the one readline edits on, so its color codes are marked as invisible
+    const char* format = "┌─{%s%s%s@%s%s%s}%s{%s%s%s}\n└─%s%c%s%c♥%c%s%c ";
+
+    int length = snprintf(NULL, 0, format,
+            accent, username, color_reset,
+            accent, hostname, color_reset, cache.filler_line,
+            accent, cache.dir, color_reset, cache.segments,
+            RL_PROMPT_START_IGNORE, accent, RL_PROMPT_END_IGNORE,
+            RL_PROMPT_START_IGNORE, color_reset, RL_PROMPT_END_IGNORE);
+
+    free(cache.prompt);
+    cache.prompt = malloc(length + 1);
+
+    snprintf(cache.prompt, length + 1, format,
+            accent, username, color_reset,
+            accent, hostname, color_reset, cache.filler_line,
+            accent, cache.dir, color_reset, cache.segments,
+            RL_PROMPT_START_IGNORE, accent, RL_PROMPT_END_IGNORE,
+            RL_PROMPT_START_IGNORE, color_reset, RL_PROMPT_END_IGNORE);
+}
+
+const char* generate_prompt() {
+    /*
+     * Generates a cute looking prompt. Only the pieces whose input changed since the last
+     * call are rebuilt: the width after SIGWINCH, the directory after cd, the color after color.
+     * The segments are cheap to format, and are compared to what's shown instead
+     *
+     * Returns: The generated prompt, owned by the cache and valid until the next call
+     */
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The color is just an int, no need to rely on being told about it
+    if (cache.color != accent_color)
+        cache.stale |= PROMPT_COLOR;
+
+    char segments[SEGMENT_LINE_SIZE];
+    segments_format(segments, sizeof(segments));
+
+    if (strcmp(segments, cache.segments) != 0) {
+        strcpy(cache.segments, segments);
+        cache.stale |= PROMPT_SEGMENTS;
+    }
+
+    if (cache.stale) {
+        if (cache.stale & PROMPT_WIDTH)
+            update_width();
+
+        if (cache.stale & PROMPT_DIR)
+            update_dir();
+
+        // The filler line makes up for the width of the directory
+        if (cache.stale & (PROMPT_WIDTH | PROMPT_DIR))
+            update_filler_line();
+
+        cache.color = accent_color;
+
+        render();
+
+        cache.stale = 0;
+        cache.rebuilds++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    cache.last_ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+    cache.total_ns += cache.last_ns;
+    if (cache.last_ns > cache.max_ns)
+        cache.max_ns = cache.last_ns;
+    cache.renders++;
+
+    return cache.prompt;
+}
+
+void prompt_print_stats() {
+    /*
+     * Prints the measured cost of rendering the prompt
+     */
+
+    printf("renders:  %ld (%ld rebuilt)\n", cache.renders, cache.rebuilds);
+
+    if (cache.renders > 0) {
+        printf("last:     %.3f us\n", cache.last_ns / 1e3);
+        printf("average:  %.3f us\n", cache.total_ns / 1e3 / cache.renders);
+        printf("max:      %.3f us\n", cache.max_ns / 1e3);
+    }
+
+    printf("\n");
+    segments_print_stats();
+}
+
+void prompt_reset_stats() {
+    cache.renders = 0;
+    cache.rebuilds = 0;
+    cache.last_ns = 0;
+    cache.total_ns = 0;
+    cache.max_ns = 0;
+}
+
+void truncate_dir(char* dir_name, int truncate_length) {
+    /*
+     * Truncates the working directory string to the last specified directories
+     *
+     * Arguments:
+     *  dir_name: A string containing the directory name
+     *  truncate_length: The number of remaining directories in the end after truncating the rest
+     */
+
+    int slash_occurences = 0;
+    
+    // First count the number of occurences of the forward slash character
+    int i = 0;
+    while(dir_name[i] != '\0') {
+        if (dir_name[i] == '/')
+            slash_occurences++;
+
+        i++;
+    }
+
+    if (slash_occurences >= truncate_length) {
+        slash_occurences = 0;
+
+        // Then we'll start from the end of the string, looking for the point at which to truncate
+        int j = strlen(dir_name) - 1;
+        while (slash_occurences != truncate_length) {
+            if (dir_name[j] == '/')
+                slash_occurences++;
+
+            j--;
+        }
+
+        // Readjust the counter
+        j += 2;
+
+        // Overwrite the truncated string on top of the original string
+        memcpy(dir_name, &dir_name[j], i - j + 1);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <limits.h>
+
+#include "segments.h"
+
+// The inputs of the prompt, each one invalidated separately
+#define PROMPT_WIDTH  1
+#define PROMPT_DIR    2
+#define PROMPT_COLOR  4
+#define PROMPT_SEGMENTS 8
+#define PROMPT_ALL    (PROMPT_WIDTH | PROMPT_DIR | PROMPT_COLOR | PROMPT_SEGMENTS)
+
+typedef struct PromptCache {
+    int stale;                  // PROMPT_* flags of the pieces to rebuild
+
+    int width;
+    char* filler_line;
+    size_t filler_capacity;
+
+    char dir[PATH_MAX];
+    int color;
+    char segments[SEGMENT_LINE_SIZE];
+
+    char* prompt;
+
+    // Render cost, for regression tracking
+    long renders;
+    long rebuilds;
+    long long last_ns;
+    long long total_ns;
+    long long max_ns;
+} PromptCache;
+
+const char* generate_prompt();
+void prompt_invalidate(int pieces);
+void prompt_print_stats();
+void prompt_reset_stats();
+
+void truncate_dir(char* dir_name, int truncate_length);
+
+#endif
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "reader.h"
+
+#include "globals.h"
+
+void reader_init(LineReader* reader, int fd) {
+    /*
+     * Prepares a line reader over a file descriptor
+     */
+
+    reader->fd = fd;
+    reader->capacity = READER_BUFFER_SIZE;
+    reader->buffer = malloc(reader->capacity);
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+}
+
+char* reader_next_line(LineReader* reader) {
+    /*
+     * Reads the next line, refilling the buffer with large reads only when it runs out
+     *
+     * Arguments:
+     *  reader: The line reader
+     *
+     * Returns: The null terminated line without its newline, valid until the next call.
+     *          NULL once the input is exhausted
+     */
+
+    size_t scanned = reader->start;
+
+    while (1) {
+        char* newline = memchr(reader->buffer + scanned, '\n', reader->end - scanned);
+
+        if (newline != NULL) {
+            char* line = reader->buffer + reader->start;
+            *newline = '\0';
+            reader->start = newline - reader->buffer + 1;
+            return line;
+        }
+
+        if (reader->eof) {
+            // Hand out the last line even if it isn't newline terminated
+            if (reader->start == reader->end)
+                return NULL;
+
+            char* line = reader->buffer + reader->start;
+            reader->buffer[reader->end] = '\0';
+            reader->start = reader->end;
+            return line;
+        }
+
+        // Move the partial line to the front, and grow the buffer if a single line fills it
+        size_t pending = reader->end - reader->start;
+        memmove(reader->buffer, reader->buffer + reader->start, pending);
+        reader->start = 0;
+        reader->end = pending;
+        scanned = pending;
+
+        if (reader->capacity - reader->end < 2) {
+            reader->capacity *= 2;
+            reader->buffer = realloc(reader->buffer, reader->capacity);
+        }
+
+        // Keep a byte for the terminator of an unterminated last line
+        ssize_t n = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end - 1);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            if (n < 0)
+                fprintf(stderr, "%serror%s: read failed: %s\n", colors[ERR_COLOR], color_reset, strerror(errno));
+
+            reader->eof = 1;
+        }
+        else
+            reader->end += n;
+    }
+}
+
+void reader_sync(LineReader* reader) {
+    /*
+     * Gives the read-ahead back to the file, so that a command started now sees the input
+     * right after the current line. Only possible when the file is seekable
+     */
+
+    size_t pending = reader->end - reader->start;
+
+    if (pending == 0)
+        return;
+
+    if (lseek(reader->fd, -(off_t) pending, SEEK_CUR) != -1) {
+        reader->start = 0;
+        reader->end = 0;
+        reader->eof = 0;
+    }
+}
+
+void reader_free(LineReader* reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+#define READER_BUFFER_SIZE 65536
+
+// Buffered line reader for non-interactive input
+typedef struct LineReader {
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t start;   // beginning of the unconsumed data
+    size_t end;     // end of the data read so far
+    int eof;
+} LineReader;
+
+void reader_init(LineReader* reader, int fd);
+char* reader_next_line(LineReader* reader);
+void reader_sync(LineReader* reader);
+void reader_free(LineReader* reader);
+
+#endif
@@ -0,0 +1,497 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <readline/readline.h>
+
+#include "segments.h"
+#include "spawn.h"
+#include "jobs.h"
+
+#include "globals.h"
+
+static void segment_git(const char* dir, char* value, const struct timespec* deadline);
+static void segment_jobs(const char* dir, char* value, const struct timespec* deadline);
+static void segment_status(const char* dir, char* value, const struct timespec* deadline);
+
+// In the order they are drawn
+static PromptSegment segments[] = {
+    { "git",    segment_git,    1, 500, 0 },
+    { "jobs",   segment_jobs,   0, 0,   0 },
+    { "status", segment_status, 0, 0,   1 },
+};
+
+#define SEGMENTS_COUNT ((int) (sizeof(segments) / sizeof(segments[0])))
+
+// Everything below is shared with the worker thread and guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+static int worker_started = 0;
+static int request_pending = 0;
+static char request_dir[PATH_MAX];
+static unsigned long request_generation = 0;
+
+static SegmentCacheEntry cache[SEGMENT_CACHE_SIZE];
+static unsigned long use_clock = 0;
+
+// Bumped after every command, since any of them may have changed what the segments show.
+// Only touched by the main thread
+static unsigned long generation = 1;
+
+// Signaled by the worker when a result changed what the prompt shows
+static int event_fd = -1;
+
+static long long elapsed_ns(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+}
+
+static SegmentCacheEntry* find_entry(const char* dir) {
+    for (int i = 0; i < SEGMENT_CACHE_SIZE; i++) {
+        if (cache[i].last_used != 0 && strcmp(cache[i].dir, dir) == 0)
+            return &cache[i];
+    }
+
+    return NULL;
+}
+
+static SegmentCacheEntry* evict_entry() {
+    // The least recently used entry, unused ones having a last_used of 0
+    SegmentCacheEntry* oldest = &cache[0];
+
+    for (int i = 1; i < SEGMENT_CACHE_SIZE; i++) {
+        if (cache[i].last_used < oldest->last_used)
+            oldest = &cache[i];
+    }
+
+    return oldest;
+}
+
+static void run_segment(PromptSegment* segment, const char* dir, char* value) {
+    struct timespec start, deadline, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    deadline = start;
+    deadline.tv_sec += segment->deadline_ms / 1000;
+    deadline.tv_nsec += (segment->deadline_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    value[0] = '\0';
+    segment->compute(dir, value, &deadline);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long ns = elapsed_ns(&start, &end);
+
+    pthread_mutex_lock(&lock);
+
+    segment->runs++;
+    segment->last_ns = ns;
+    if (ns > segment->max_ns)
+        segment->max_ns = ns;
+    if (segment->async && elapsed_ns(&deadline, &end) > 0)
+        segment->timeouts++;
+
+    pthread_mutex_unlock(&lock);
+}
+
+static void* worker_main(void* arg) {
+    /*
+     * Computes the asynchronous segments of whichever directory the prompt was last drawn in,
+     * caching them and waking the interactive loop up when the prompt should change
+     */
+
+    char dir[PATH_MAX];
+    char values[SEGMENTS_MAX][SEGMENT_VALUE_SIZE];
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+
+        while (!request_pending)
+            pthread_cond_wait(&wakeup, &lock);
+
+        strcpy(dir, request_dir);
+        unsigned long request = request_generation;
+        request_pending = 0;
+
+        pthread_mutex_unlock(&lock);
+
+        memset(values, 0, sizeof(values));
+
+        for (int i = 0; i < SEGMENTS_COUNT; i++) {
+            if (segments[i].async)
+                run_segment(&segments[i], dir, values[i]);
+        }
+
+        pthread_mutex_lock(&lock);
+
+        SegmentCacheEntry* entry = find_entry(dir);
+        int changed = 1;
+
+        if (entry == NULL) {
+            entry = evict_entry();
+            strcpy(entry->dir, dir);
+            entry->last_used = ++use_clock;
+        }
+        else
+            changed = memcmp(entry->values, values, sizeof(values)) != 0;
+
+        memcpy(entry->values, values, sizeof(values));
+        entry->generation = request;
+
+        pthread_mutex_unlock(&lock);
+
+        if (changed) {
+            uint64_t one = 1;
+            write(event_fd, &one, sizeof(one));
+        }
+    }
+
+    return NULL;
+}
+
+static void start_worker() {
+    // The worker leaves every signal to the main thread, which reads some of them from a signalfd
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, worker_main, NULL) == 0) {
+        pthread_detach(worker);
+        worker_started = 1;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+int segments_fd() {
+    /*
+     * Returns: A descriptor that becomes readable when asynchronous segments have new values
+     *          and the prompt should be drawn again
+     */
+
+    if (event_fd == -1)
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return event_fd;
+}
+
+void segments_refresh() {
+    /*
+     * Marks the cached segments as out of date, to be computed again the next time they are shown.
+     * Until then the old values are still drawn
+     */
+
+    generation++;
+}
+
+int segments_collect() {
+    /*
+     * Consumes the worker's notification
+     *
+     * Returns: 1 if the prompt should be drawn again, 0 otherwise
+     */
+
+    uint64_t count;
+    return read(segments_fd(), &count, sizeof(count)) == sizeof(count);
+}
+
+void segments_format(char* buffer, size_t size) {
+    /*
+     * Writes the segments of the current directory for the last line of the prompt.
+     * Asynchronous segments come from the cache, and are computed in the background
+     * when they are missing or out of date
+     *
+     * Arguments:
+     *  buffer: Where to write them, SEGMENT_LINE_SIZE bytes is enough for all of them
+     *  size: The size of buffer
+     */
+
+    char dir[PATH_MAX];
+    if (getcwd(dir, sizeof(dir)) == NULL)
+        strcpy(dir, "?");
+
+    char values[SEGMENTS_MAX][SEGMENT_VALUE_SIZE];
+
+    pthread_mutex_lock(&lock);
+
+    SegmentCacheEntry* entry = find_entry(dir);
+
+    if (entry != NULL) {
+        memcpy(values, entry->values, sizeof(values));
+        entry->last_used = ++use_clock;
+    }
+    else {
+        for (int i = 0; i < SEGMENTS_COUNT; i++)
+            strcpy(values[i], SEGMENT_PLACEHOLDER);
+    }
+
+    int wanted = (entry == NULL || entry->generation != generation);
+    int requested = (request_generation == generation && strcmp(request_dir, dir) == 0);
+
+    if (wanted && !requested) {
+        strcpy(request_dir, dir);
+        request_generation = generation;
+        request_pending = 1;
+
+        if (segments_fd() != -1 && !worker_started)
+            start_worker();
+
+        pthread_cond_signal(&wakeup);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    // The cheap ones are computed on the spot
+    for (int i = 0; i < SEGMENTS_COUNT; i++) {
+        if (!segments[i].async)
+            run_segment(&segments[i], dir, values[i]);
+    }
+
+    // Color codes are wrapped for readline, which would count them as visible otherwise
+    size_t length = 0;
+    buffer[0] = '\0';
+
+    for (int i = 0; i < SEGMENTS_COUNT && length < size; i++) {
+        if (values[i][0] == '\0')
+            continue;
+
+        const char* color = colors[segments[i].error_color ? ERR_COLOR : accent_color];
+
+        length += snprintf(buffer + length, size - length, "{%c%s%c%s%c%s%c}─",
+                RL_PROMPT_START_IGNORE, color, RL_PROMPT_END_IGNORE, values[i],
+                RL_PROMPT_START_IGNORE, color_reset, RL_PROMPT_END_IGNORE);
+    }
+}
+
+void segments_print_stats() {
+    /*
+     * Prints how long each segment takes to compute
+     */
+
+    printf("segment  mode          runs     timeouts  last (us)  max (us)\n");
+
+    pthread_mutex_lock(&lock);
+
+    for (int i = 0; i < SEGMENTS_COUNT; i++) {
+        PromptSegment* segment = &segments[i];
+        char mode[32];
+
+        if (segment->async)
+            snprintf(mode, sizeof(mode), "async %dms", segment->deadline_ms);
+        else
+            strcpy(mode, "sync");
+
+        printf("%-7s  %-12s  %-7ld  %-8ld  %-9.1f  %-9.1f\n", segment->name, mode, segment->runs,
+                segment->timeouts, segment->last_ns / 1e3, segment->max_ns / 1e3);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static int find_git_dir(const char* dir, char* worktree, char* git_dir) {
+    /*
+     * Looks for the repository containing dir, walking up to the root
+     *
+     * Arguments:
+     *  worktree, git_dir: Filled with the top of the work tree and the git directory, PATH_MAX bytes each
+     *
+     * Returns: 1 if dir is inside a repository, 0 otherwise
+     */
+
+    char path[PATH_MAX];
+    strcpy(path, dir);
+
+    while (1) {
+        char candidate[PATH_MAX + 8];
+        snprintf(candidate, sizeof(candidate), "%s/.git", strcmp(path, "/") == 0 ? "" : path);
+
+        struct stat info;
+        if (stat(candidate, &info) == 0) {
+            strcpy(worktree, path);
+
+            if (S_ISDIR(info.st_mode))
+                return snprintf(git_dir, PATH_MAX, "%s", candidate) < PATH_MAX;
+
+            // Worktrees and submodules have a file pointing to the git directory instead
+            char line[PATH_MAX];
+            int fd = open(candidate, O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                return 0;
+
+            ssize_t n = read(fd, line, sizeof(line) - 1);
+            close(fd);
+
+            if (n <= 8 || strncmp(line, "gitdir: ", 8) != 0)
+                return 0;
+
+            line[n] = '\0';
+            line[strcspn(line, "\n")] = '\0';
+
+            if (line[8] == '/')
+                return snprintf(git_dir, PATH_MAX, "%s", line + 8) < PATH_MAX;
+            else
+                return snprintf(git_dir, PATH_MAX, "%s/%s", path, line + 8) < PATH_MAX;
+        }
+
+        char* slash = strrchr(path, '/');
+        if (slash == NULL || strcmp(path, "/") == 0)
+            return 0;
+
+        if (slash == path)
+            slash[1] = '\0';
+        else
+            *slash = '\0';
+    }
+}
+
+static int git_dirty(const char* worktree, const struct timespec* deadline) {
+    /*
+     * Asks git whether the work tree has changes, killing it once the deadline passes.
+     * The first byte of output is enough to know, so git is stopped right there
+     *
+     * Returns: 1 if dirty, 0 if clean, -1 if it couldn't be told in time
+     */
+
+    int output[2];
+    if (pipe2(output, O_CLOEXEC) == -1)
+        return -1;
+
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    char* argv[] = { "git", "--no-optional-locks", "-C", (char*) worktree, "status", "--porcelain", NULL };
+
+    SpawnRequest request;
+    spawn_request_init(&request, argv);
+    request.fds[STDIN_FILENO] = null_fd;
+    request.fds[STDOUT_FILENO] = output[1];
+    request.fds[STDERR_FILENO] = null_fd;
+
+    pid_t pid = spawn_hidden(&request);
+
+    close(output[1]);
+    if (null_fd != -1)
+        close(null_fd);
+
+    if (pid == -1) {
+        close(output[0]);
+        return -1;
+    }
+
+    int dirty = -1;
+
+    while (1) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // Rounded up, so a timeout really is past the deadline
+        long long remaining = elapsed_ns(&now, (struct timespec*) deadline);
+        if (remaining <= 0)
+            break;
+
+        struct pollfd poll_fd = { output[0], POLLIN, 0 };
+        int ready = poll(&poll_fd, 1, (remaining + 999999) / 1000000);
+
+        if (ready == -1 && errno == EINTR)
+            continue;
+        if (ready <= 0)
+            break;
+
+        char byte;
+        ssize_t n = read(output[0], &byte, 1);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        dirty = (n == 1);
+        break;
+    }
+
+    close(output[0]);
+
+    // Either it's done already, or we don't need the rest of its answer
+    kill(pid, SIGKILL);
+
+    int status;
+    waitpid(pid, &status, __WCLONE);
+
+    // A clean answer only counts if git was happy with the repository
+    if (dirty == 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+        return -1;
+
+    return dirty;
+}
+
+static void segment_git(const char* dir, char* value, const struct timespec* deadline) {
+    /*
+     * The branch of the repository, or the abbreviated commit when detached, followed by
+     * '*' when the work tree is dirty and '?' when git didn't answer in time
+     */
+
+    char worktree[PATH_MAX];
+    char git_dir[PATH_MAX];
+
+    if (!find_git_dir(dir, worktree, git_dir))
+        return;
+
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/HEAD", git_dir);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+
+    char head[256];
+    ssize_t n = read(fd, head, sizeof(head) - 1);
+    close(fd);
+
+    if (n <= 0)
+        return;
+
+    head[n] = '\0';
+    head[strcspn(head, "\n")] = '\0';
+
+    const char* ref_prefix = "ref: refs/heads/";
+    int length;
+
+    if (strncmp(head, ref_prefix, strlen(ref_prefix)) == 0)
+        length = snprintf(value, SEGMENT_VALUE_SIZE - 1, "%s", head + strlen(ref_prefix));
+    else
+        length = snprintf(value, SEGMENT_VALUE_SIZE - 1, "%.7s", head);
+
+    if (length > SEGMENT_VALUE_SIZE - 2)
+        length = SEGMENT_VALUE_SIZE - 2;
+
+    int dirty = git_dirty(worktree, deadline);
+
+    if (dirty != 0) {
+        value[length] = (dirty == 1) ? '*' : '?';
+        value[length + 1] = '\0';
+    }
+}
+
+static void segment_jobs(const char* dir, char* value, const struct timespec* deadline) {
+    if (job_table.count > 0)
+        snprintf(value, SEGMENT_VALUE_SIZE, "%d job%s", job_table.count, job_table.count == 1 ? "" : "s");
+}
+
+static void segment_status(const char* dir, char* value, const struct timespec* deadline) {
+    if (last_exit_status != 0)
+        snprintf(value, SEGMENT_VALUE_SIZE, "%d", last_exit_status);
+}
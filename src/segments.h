@@ -0,0 +1,50 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <limits.h>
+#include <time.h>
+
+#define SEGMENTS_MAX        8
+#define SEGMENT_VALUE_SIZE  128
+#define SEGMENT_CACHE_SIZE  32
+
+// Room for every segment with its color codes and decorations
+#define SEGMENT_LINE_SIZE   (SEGMENTS_MAX * (SEGMENT_VALUE_SIZE + 64))
+
+// Shown until an asynchronous segment has been computed for the first time in a directory
+#define SEGMENT_PLACEHOLDER "…"
+
+// A piece of information shown on the last line of the prompt
+typedef struct PromptSegment {
+    const char* name;
+
+    // Writes the segment's text for dir into value, or an empty string to hide it.
+    // Asynchronous segments should give up once the deadline has passed
+    void (*compute)(const char* dir, char* value, const struct timespec* deadline);
+
+    int async;                  // computed on the worker thread, with the result cached per directory
+    int deadline_ms;
+    int error_color;            // drawn in the error color instead of the accent color
+
+    // Cost of computing it, for regression tracking
+    long runs;
+    long timeouts;
+    long long last_ns;
+    long long max_ns;
+} PromptSegment;
+
+// The values of the asynchronous segments in one directory
+typedef struct SegmentCacheEntry {
+    char dir[PATH_MAX];
+    char values[SEGMENTS_MAX][SEGMENT_VALUE_SIZE];
+    unsigned long generation;   // the segments_refresh() generation they were computed for
+    unsigned long last_used;
+} SegmentCacheEntry;
+
+int segments_fd();
+void segments_refresh();
+int segments_collect();
+void segments_format(char* buffer, size_t size);
+void segments_print_stats();
+
+#endif
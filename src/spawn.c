@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+#include "trace.h"
+
+#include "globals.h"
+
+#define CLONE_STACK_SIZE 65536
+
+extern char** environ;
+
+SpawnBackend spawn_backend = SPAWN_POSIX;
+
+const char* spawn_backend_names[] = {
+    [SPAWN_POSIX] = "posix_spawn",
+    [SPAWN_VFORK] = "vfork",
+    [SPAWN_FORK]  = "fork",
+};
+
+static SpawnStats spawn_stats[SPAWN_BACKENDS];
+
+// The signal mask children start with. The shell itself may block signals it reads through a signalfd
+sigset_t spawn_sigmask;
+
+// Written by a vfork child that shares our memory, when its exec fails
+static volatile int vfork_child_errno;
+
+static long long elapsed_ns(struct timespec* start, struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+}
+
+void spawn_init() {
+    /*
+     * Picks the spawn backend named by the CASH_SPAWN environment variable, if any
+     */
+
+    char* name = getenv("CASH_SPAWN");
+
+    if (name != NULL && !spawn_set_backend(name))
+        fprintf(stderr, "%serror%s: unknown spawn backend '%s'\n", colors[ERR_COLOR], color_reset, name);
+
+    sigemptyset(&spawn_sigmask);
+    spawn_reset_stats();
+}
+
+void spawn_request_init(SpawnRequest* request, char** argv) {
+    /*
+     * Prepares a request that runs argv with our own stdin, stdout and stderr
+     */
+
+    request->argv = argv;
+    request->path = NULL;
+    request->fds[STDIN_FILENO] = -1;
+    request->fds[STDOUT_FILENO] = -1;
+    request->fds[STDERR_FILENO] = -1;
+}
+
+static void setup_child_fds(SpawnRequest* request) {
+    /*
+     * Moves the requested descriptors into place in a child. Everything else the shell opens
+     * is close-on-exec, so nothing has to be closed here
+     */
+
+    for (int i = 0; i < 3; i++) {
+        if (request->fds[i] != -1 && request->fds[i] != i)
+            dup2(request->fds[i], i);
+    }
+}
+
+static void exec_request(SpawnRequest* request) {
+    if (request->path != NULL)
+        execv(request->path, request->argv);
+    else
+        execvp(request->argv[0], request->argv);
+}
+
+static pid_t spawn_posix(SpawnRequest* request) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &spawn_sigmask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    for (int i = 0; i < 3; i++) {
+        if (request->fds[i] != -1 && request->fds[i] != i)
+            posix_spawn_file_actions_adddup2(&actions, request->fds[i], i);
+    }
+
+    pid_t pid;
+    int error;
+
+    if (request->path != NULL)
+        error = posix_spawn(&pid, request->path, &actions, &attr, request->argv, environ);
+    else
+        error = posix_spawnp(&pid, request->argv[0], &actions, &attr, request->argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+
+    return pid;
+}
+
+static int vfork_child(void* arg) {
+    /*
+     * Runs on a private stack but in the shell's memory, so it may only touch its own locals
+     * and vfork_child_errno before it execs
+     */
+
+    SpawnRequest* request = arg;
+
+    setup_child_fds(request);
+    sigprocmask(SIG_SETMASK, &spawn_sigmask, NULL);
+
+    exec_request(request);
+
+    vfork_child_errno = errno;
+    _exit(127);
+}
+
+static pid_t spawn_vfork(SpawnRequest* request) {
+    static char* stack = NULL;
+
+    if (stack == NULL)
+        stack = malloc(CLONE_STACK_SIZE);
+
+    // Keep our signal handlers from running in the child while it shares our memory
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &old_mask);
+
+    vfork_child_errno = 0;
+
+    // We are suspended until the child execs or exits, the stack grows down on every Linux target
+    pid_t pid = clone(vfork_child, stack + CLONE_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, request);
+    int clone_errno = errno;
+
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (pid == -1) {
+        errno = clone_errno;
+        return -1;
+    }
+
+    if (vfork_child_errno != 0) {
+        waitpid(pid, NULL, 0);
+        errno = vfork_child_errno;
+        return -1;
+    }
+
+    return pid;
+}
+
+// A hidden child reports a failed exec through here, every caller has its own
+typedef struct HiddenChild {
+    SpawnRequest* request;
+    int error;
+} HiddenChild;
+
+static int hidden_child(void* arg) {
+    HiddenChild* child = arg;
+
+    setup_child_fds(child->request);
+    sigprocmask(SIG_SETMASK, &spawn_sigmask, NULL);
+
+    exec_request(child->request);
+
+    child->error = errno;
+    _exit(127);
+}
+
+pid_t spawn_hidden(SpawnRequest* request) {
+    /*
+     * Starts a child that sends no signal when it exits, so it is invisible to waitpid(-1)
+     * and to SIGCHLD. Used for helpers the shell runs for itself, off the main thread,
+     * which the job table must not reap
+     *
+     * Arguments:
+     *  request: The command and the descriptors to hand it
+     *
+     * Returns: The child's pid, to be waited for with waitpid(pid, &status, __WCLONE).
+     *          -1 with errno set if it couldn't be started or executed
+     */
+
+    // Safe to call from any thread, so nothing here is shared with spawn_vfork()
+    char* stack = malloc(CLONE_STACK_SIZE);
+    if (stack == NULL)
+        return -1;
+
+    HiddenChild child = { request, 0 };
+
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+
+    pid_t pid = clone(hidden_child, stack + CLONE_STACK_SIZE, CLONE_VM | CLONE_VFORK, &child);
+    int clone_errno = errno;
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    free(stack);
+
+    if (pid == -1) {
+        errno = clone_errno;
+        return -1;
+    }
+
+    if (child.error != 0) {
+        waitpid(pid, NULL, __WCLONE);
+        errno = child.error;
+        return -1;
+    }
+
+    return pid;
+}
+
+static pid_t spawn_fork(SpawnRequest* request) {
+    // The child reports a failed exec through a close-on-exec pipe
+    int error_pipe[2];
+    if (pipe2(error_pipe, O_CLOEXEC) == -1)
+        return -1;
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(error_pipe[0]);
+        setup_child_fds(request);
+        sigprocmask(SIG_SETMASK, &spawn_sigmask, NULL);
+
+        exec_request(request);
+
+        int error = errno;
+        write(error_pipe[1], &error, sizeof(error));
+        _exit(127);
+    }
+
+    close(error_pipe[1]);
+
+    if (pid == -1) {
+        close(error_pipe[0]);
+        return -1;
+    }
+
+    // Reading nothing means the exec went through and closed the pipe
+    int error;
+    ssize_t n;
+    do {
+        n = read(error_pipe[0], &error, sizeof(error));
+    } while (n < 0 && errno == EINTR);
+
+    close(error_pipe[0]);
+
+    if (n == sizeof(error)) {
+        waitpid(pid, NULL, 0);
+        errno = error;
+        return -1;
+    }
+
+    return pid;
+}
+
+pid_t spawn_process(SpawnRequest* request) {
+    /*
+     * Starts a child process running request->argv with the selected backend
+     *
+     * Arguments:
+     *  request: The command and the descriptors to hand it
+     *
+     * Returns: The child's pid, or -1 with errno set if the process couldn't be started
+     *          or the command couldn't be executed
+     */
+
+    // Anything the shell printed has to come out before the child's output
+    fflush(stdout);
+
+    long long span = trace_begin();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    SpawnBackend backend = spawn_backend;
+    pid_t pid;
+
+    switch (backend) {
+        case SPAWN_POSIX:
+            pid = spawn_posix(request);
+            break;
+        case SPAWN_VFORK:
+            pid = spawn_vfork(request);
+
+            // clone can be unavailable (e.g. filtered by seccomp), fork still works then
+            if (pid == -1 && (errno == ENOSYS || errno == EPERM)) {
+                backend = SPAWN_FORK;
+                pid = spawn_fork(request);
+            }
+            break;
+        default:
+            backend = SPAWN_FORK;
+            pid = spawn_fork(request);
+            break;
+    }
+
+    int saved_errno = errno;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long ns = elapsed_ns(&start, &end);
+
+    SpawnStats* stats = &spawn_stats[backend];
+    stats->count++;
+    stats->total_ns += ns;
+    if (ns < stats->min_ns)
+        stats->min_ns = ns;
+    if (ns > stats->max_ns)
+        stats->max_ns = ns;
+
+    trace_end("spawn", span, pid, -1, spawn_backend_names[backend]);
+
+    errno = saved_errno;
+
+    return pid;
+}
+
+int spawn_set_backend(const char* name) {
+    /*
+     * Selects the spawn backend by name
+     *
+     * Returns: 1 on success, 0 if there's no such backend
+     */
+
+    for (int i = 0; i < SPAWN_BACKENDS; i++) {
+        if (strcmp(name, spawn_backend_names[i]) == 0) {
+            spawn_backend = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void spawn_print_stats() {
+    /*
+     * Prints the spawn latency of each backend, measured from the call to the parent resuming
+     */
+
+    printf("backend       count      avg (us)   min (us)   max (us)\n");
+
+    for (int i = 0; i < SPAWN_BACKENDS; i++) {
+        SpawnStats* stats = &spawn_stats[i];
+
+        printf("%s%-12s%s  %-9ld  ", (i == spawn_backend) ? colors[accent_color] : "",
+                spawn_backend_names[i], (i == spawn_backend) ? color_reset : "", stats->count);
+
+        if (stats->count == 0)
+            printf("-          -          -\n");
+        else
+            printf("%-9.1f  %-9.1f  %-9.1f\n", stats->total_ns / 1e3 / stats->count,
+                    stats->min_ns / 1e3, stats->max_ns / 1e3);
+    }
+}
+
+void spawn_reset_stats() {
+    for (int i = 0; i < SPAWN_BACKENDS; i++) {
+        spawn_stats[i].count = 0;
+        spawn_stats[i].total_ns = 0;
+        spawn_stats[i].min_ns = LLONG_MAX;
+        spawn_stats[i].max_ns = 0;
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <unistd.h>
+#include <signal.h>
+
+typedef enum SpawnBackend {
+    SPAWN_POSIX,    // posix_spawnp() with file actions
+    SPAWN_VFORK,    // clone(CLONE_VM | CLONE_VFORK), shares our memory until the exec
+    SPAWN_FORK,     // plain fork(), copies our page tables
+    SPAWN_BACKENDS
+} SpawnBackend;
+
+// Everything a child is set up with before it execs
+typedef struct SpawnRequest {
+    char** argv;
+    char* path;     // the resolved executable, or NULL to search PATH
+    int fds[3];     // descriptors to place on stdin, stdout and stderr, -1 to inherit ours
+} SpawnRequest;
+
+typedef struct SpawnStats {
+    long count;
+    long long total_ns;
+    long long min_ns;
+    long long max_ns;
+} SpawnStats;
+
+extern SpawnBackend spawn_backend;
+extern sigset_t spawn_sigmask;
+extern const char* spawn_backend_names[];
+
+void spawn_init();
+void spawn_request_init(SpawnRequest* request, char** argv);
+pid_t spawn_process(SpawnRequest* request);
+pid_t spawn_hidden(SpawnRequest* request);
+int spawn_set_backend(const char* name);
+void spawn_print_stats();
+void spawn_reset_stats();
+
+#endif
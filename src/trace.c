@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+
+#include "trace.h"
+
+#include "globals.h"
+
+int trace_enabled = 0;
+
+static TraceRing ring;
+
+static void flush_at_exit() {
+    if (trace_enabled)
+        trace_flush();
+}
+
+void trace_init() {
+    /*
+     * Turns tracing on from the start if CASH_TRACE is set, to the file it names, or
+     * to the default file if it's set to 1
+     */
+
+    char* path = getenv("CASH_TRACE");
+
+    if (path == NULL || *path == '\0')
+        return;
+
+    trace_start(strcmp(path, "1") == 0 ? TRACE_DEFAULT_FILE : path);
+}
+
+int trace_start(const char* path) {
+    /*
+     * Starts recording events, dropping the ones recorded before
+     *
+     * Arguments:
+     *  path: The file the trace is written to when it's stopped, or when the shell exits
+     *
+     * Returns: 1 on success, 0 if there's no memory for the ring
+     */
+
+    if (ring.events == NULL) {
+        ring.events = malloc(sizeof(TraceEvent) * TRACE_RING_SIZE);
+
+        if (ring.events == NULL)
+            return 0;
+
+        atexit(flush_at_exit);
+    }
+
+    free(ring.path);
+
+    // The shell may have changed directory by the time the trace is written
+    char cwd[PATH_MAX];
+    if (path[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL) {
+        ring.path = malloc(strlen(cwd) + strlen(path) + 2);
+        sprintf(ring.path, "%s/%s", cwd, path);
+    }
+    else
+        ring.path = strdup(path);
+    ring.recorded = 0;
+
+    trace_enabled = 1;
+
+    return 1;
+}
+
+void trace_stop() {
+    if (!trace_enabled)
+        return;
+
+    trace_flush();
+    trace_enabled = 0;
+}
+
+long long trace_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void trace_record(const char* name, char phase, long long start, pid_t pid, int stage, int status, const char* detail) {
+    /*
+     * Adds an event to the ring. Only the shell's main thread records events
+     *
+     * Arguments:
+     *  name: A string literal naming the event
+     *  phase: 'X' for a span that started at start and ends now, 'i' for an instant
+     *  detail: Copied, since it usually comes from line_arena. NULL for none
+     */
+
+    long long now = trace_now();
+    TraceEvent* event = &ring.events[ring.recorded % TRACE_RING_SIZE];
+
+    event->name = name;
+    event->phase = phase;
+    event->start_ns = (phase == 'X') ? start : now;
+    event->duration_ns = (phase == 'X') ? now - start : 0;
+    event->pid = pid;
+    event->stage = stage;
+    event->status = status;
+
+    if (detail != NULL)
+        snprintf(event->detail, TRACE_DETAIL_SIZE, "%s", detail);
+    else
+        event->detail[0] = '\0';
+
+    ring.recorded++;
+}
+
+static void write_string(FILE* file, const char* str) {
+    // Only what JSON needs escaped, the details are command names
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf(file, "\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            fprintf(file, "\\u%04x", *str);
+        else
+            fputc(*str, file);
+    }
+}
+
+int trace_flush() {
+    /*
+     * Writes the events in the ring to the trace file, as Chrome trace event JSON that
+     * chrome://tracing and Perfetto can open
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise
+     */
+
+    FILE* file = fopen(ring.path, "w");
+
+    if (file == NULL) {
+        fprintf(stderr, "%serror%s: can't write the trace to %s: %s\n", colors[ERR_COLOR], color_reset, ring.path, strerror(errno));
+        return 0;
+    }
+
+    long long first = (ring.recorded > TRACE_RING_SIZE) ? ring.recorded - TRACE_RING_SIZE : 0;
+    pid_t shell = getpid();
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for (long long i = first; i < ring.recorded; i++) {
+        TraceEvent* event = &ring.events[i % TRACE_RING_SIZE];
+
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,", (i == first) ? "" : ",\n",
+                event->name, event->phase, event->start_ns / 1e3);
+
+        if (event->phase == 'X')
+            fprintf(file, "\"dur\":%.3f,", event->duration_ns / 1e3);
+        else
+            fprintf(file, "\"s\":\"t\",");
+
+        fprintf(file, "\"pid\":%d,\"tid\":%d,\"args\":{", shell, shell);
+
+        const char* separator = "";
+
+        if (event->pid != -1) {
+            fprintf(file, "\"pid\":%d", event->pid);
+            separator = ",";
+        }
+
+        if (event->stage != -1) {
+            fprintf(file, "%s\"stage\":%d", separator, event->stage);
+            separator = ",";
+        }
+
+        if (event->status != -1) {
+            fprintf(file, "%s\"status\":%d", separator, event->status);
+            separator = ",";
+        }
+
+        if (event->detail[0] != '\0') {
+            fprintf(file, "%s\"detail\":\"", separator);
+            write_string(file, event->detail);
+            fprintf(file, "\"");
+        }
+
+        fprintf(file, "}}");
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    return 1;
+}
+
+void trace_print_status() {
+    if (!trace_enabled) {
+        printf("tracing is off\n");
+        return;
+    }
+
+    long long kept = (ring.recorded > TRACE_RING_SIZE) ? TRACE_RING_SIZE : ring.recorded;
+
+    printf("tracing to %s, %lld events recorded, the last %lld are kept\n", ring.path, ring.recorded, kept);
+}
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+#include <unistd.h>
+
+// Events kept in memory. Once it's full the oldest ones are overwritten
+#define TRACE_RING_SIZE 65536
+
+#define TRACE_DETAIL_SIZE 32
+
+#define TRACE_DEFAULT_FILE "cash-trace.json"
+
+// A span ('X') or an instant ('i') in Chrome's trace event format
+typedef struct TraceEvent {
+    const char* name;
+    char phase;
+    long long start_ns;
+    long long duration_ns;
+    int pid;                // the child it's about, -1 for none
+    int stage;              // the pipeline stage it's about, -1 for none
+    int status;             // the exit status for an exit event, -1 for none
+    char detail[TRACE_DETAIL_SIZE];
+} TraceEvent;
+
+typedef struct TraceRing {
+    TraceEvent* events;
+    long long recorded;     // events recorded since tracing was turned on, the ring holds the last ones
+    char* path;
+} TraceRing;
+
+extern int trace_enabled;
+
+void trace_init();
+int trace_start(const char* path);
+void trace_stop();
+int trace_flush();
+void trace_print_status();
+
+long long trace_now();
+void trace_record(const char* name, char phase, long long start, pid_t pid, int stage, int status, const char* detail);
+
+static inline long long trace_begin() {
+    /*
+     * Returns: The start of a span, or 0 when tracing is off, which makes the span a no-op
+     */
+
+    return trace_enabled ? trace_now() : 0;
+}
+
+static inline void trace_end(const char* name, long long start, pid_t pid, int stage, const char* detail) {
+    if (start != 0)
+        trace_record(name, 'X', start, pid, stage, -1, detail);
+}
+
+static inline void trace_instant(const char* name, pid_t pid, int stage, int status) {
+    if (trace_enabled)
+        trace_record(name, 'i', 0, pid, stage, status, NULL);
+}
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "usage.h"
+#include "execute.h"
+#include "trace.h"
+
+#include "globals.h"
+
+LineUsage line_usage;
+
+void usage_begin(int stages, int precise) {
+    /*
+     * Starts recording a new foreground command line, forgetting the previous one
+     *
+     * Arguments:
+     *  stages: The number of pipeline stages
+     *  precise: Whether to reap stages in the order they exit, which costs a pidfd each
+     */
+
+    for (int i = 0; i < line_usage.stages_num; i++)
+        free(line_usage.stages[i].command);
+
+    if (stages > line_usage.capacity) {
+        line_usage.capacity = stages;
+        line_usage.stages = realloc(line_usage.stages, sizeof(StageUsage) * stages);
+    }
+
+    memset(line_usage.stages, 0, sizeof(StageUsage) * stages);
+
+    for (int i = 0; i < stages; i++) {
+        line_usage.stages[i].pid = -1;
+        line_usage.stages[i].status = -1;
+    }
+
+    line_usage.stages_num = stages;
+    line_usage.precise = precise;
+}
+
+void usage_spawned(int stage, const char* command, pid_t pid) {
+    StageUsage* usage = &line_usage.stages[stage];
+
+    usage->command = strdup(command);
+    usage->pid = pid;
+    clock_gettime(CLOCK_MONOTONIC, &usage->start);
+}
+
+void usage_reaped(int stage, int status, const struct rusage* rusage) {
+    StageUsage* usage = &line_usage.stages[stage];
+
+    clock_gettime(CLOCK_MONOTONIC, &usage->end);
+    usage->status = exit_status(status);
+    usage->usage = *rusage;
+
+    trace_instant("exit", usage->pid, stage, usage->status);
+}
+
+void usage_builtin_begin(int stage, const char* command) {
+    /*
+     * Starts measuring a builtin that runs in the shell. Only the shell's main thread is
+     * counted, so the prompt and history threads don't get billed to it
+     */
+
+    StageUsage* usage = &line_usage.stages[stage];
+
+    usage->command = strdup(command);
+    usage->pid = -1;
+    getrusage(RUSAGE_THREAD, &usage->usage);
+    clock_gettime(CLOCK_MONOTONIC, &usage->start);
+}
+
+static void subtract_time(struct timeval* result, const struct timeval* before) {
+    result->tv_sec -= before->tv_sec;
+    result->tv_usec -= before->tv_usec;
+
+    if (result->tv_usec < 0) {
+        result->tv_sec--;
+        result->tv_usec += 1000000;
+    }
+}
+
+void usage_builtin_end(int stage, int status) {
+    StageUsage* usage = &line_usage.stages[stage];
+    struct rusage before = usage->usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &usage->end);
+    getrusage(RUSAGE_THREAD, &usage->usage);
+    usage->status = status;
+
+    subtract_time(&usage->usage.ru_utime, &before.ru_utime);
+    subtract_time(&usage->usage.ru_stime, &before.ru_stime);
+    usage->usage.ru_nvcsw -= before.ru_nvcsw;
+    usage->usage.ru_nivcsw -= before.ru_nivcsw;
+
+    // The peak stays the shell's own, there's nothing to subtract from a maximum
+}
+
+void usage_wait(pid_t* pids, int stages) {
+    /*
+     * Reaps the processes of a command line with wait4(), recording what each one used.
+     * Stages are normally reaped in order, which is all the exit status needs. When the
+     * line is timed, they're reaped as they exit instead, so a stage that ends early isn't
+     * charged for the time the ones before it kept running
+     *
+     * Arguments:
+     *  pids: The pid of every stage, -1 for stages without a process
+     *  stages: The number of stages
+     */
+
+    long long span = trace_begin();
+
+    int status;
+    struct rusage rusage;
+
+    int* pidfds = NULL;
+    int watched = 0;
+
+    if (line_usage.precise && stages > 1) {
+        pidfds = malloc(sizeof(int) * stages);
+
+        for (int i = 0; i < stages; i++) {
+            pidfds[i] = (pids[i] != -1) ? syscall(SYS_pidfd_open, pids[i], 0) : -1;
+
+            if (pidfds[i] != -1)
+                watched++;
+        }
+    }
+
+    struct pollfd* pollfds = (watched > 0) ? malloc(sizeof(struct pollfd) * stages) : NULL;
+
+    while (watched > 0) {
+        int n = 0;
+
+        for (int i = 0; i < stages; i++) {
+            if (pidfds[i] != -1) {
+                pollfds[n].fd = pidfds[i];
+                pollfds[n].events = POLLIN;
+                n++;
+            }
+        }
+
+        poll(pollfds, n, -1);
+
+        for (int i = 0; i < stages; i++) {
+            if (pidfds[i] != -1 && wait4(pids[i], &status, WNOHANG, &rusage) == pids[i]) {
+                usage_reaped(i, status, &rusage);
+
+                close(pidfds[i]);
+                pidfds[i] = -1;
+                pids[i] = -1;
+                watched--;
+            }
+        }
+    }
+
+    free(pidfds);
+    free(pollfds);
+
+    // Whatever had no pidfd is waited for in order
+    for (int i = 0; i < stages; i++) {
+        if (pids[i] != -1 && wait4(pids[i], &status, 0, &rusage) != -1)
+            usage_reaped(i, status, &rusage);
+    }
+
+    trace_end("wait", span, -1, -1, NULL);
+}
+
+double usage_seconds(const struct timeval* time) {
+    return time->tv_sec + time->tv_usec / 1e6;
+}
+
+static double elapsed(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void usage_print() {
+    /*
+     * Prints what every stage of the last foreground command line used, to stderr like
+     * the output of other shells' time
+     */
+
+    if (line_usage.stages_num == 0) {
+        fprintf(stderr, "nothing has run yet\n");
+        return;
+    }
+
+    fprintf(stderr, "stage  %-16s %6s %9s %9s %9s %9s %7s %7s\n",
+            "command", "status", "real", "user", "sys", "maxrss", "vcsw", "ivcsw");
+
+    struct timespec first = { 0 }, last = { 0 };
+    double user = 0, sys = 0;
+
+    for (int i = 0; i < line_usage.stages_num; i++) {
+        StageUsage* stage = &line_usage.stages[i];
+
+        if (stage->status == -1) {
+            fprintf(stderr, "%5d  %-16s %6s\n", i + 1, stage->command != NULL ? stage->command : "", "-");
+            continue;
+        }
+
+        if (first.tv_sec == 0 || elapsed(&stage->start, &first) > 0)
+            first = stage->start;
+        if (elapsed(&last, &stage->end) > 0)
+            last = stage->end;
+
+        user += usage_seconds(&stage->usage.ru_utime);
+        sys += usage_seconds(&stage->usage.ru_stime);
+
+        fprintf(stderr, "%5d  %-16.16s %6d %8.3fs %8.3fs %8.3fs %7.1fM %7ld %7ld%s\n", i + 1, stage->command,
+                stage->status, elapsed(&stage->start, &stage->end),
+                usage_seconds(&stage->usage.ru_utime), usage_seconds(&stage->usage.ru_stime),
+                stage->usage.ru_maxrss / 1024.0, stage->usage.ru_nvcsw, stage->usage.ru_nivcsw,
+                stage->pid == -1 ? "  (in the shell)" : "");
+    }
+
+    if (line_usage.stages_num > 1)
+        fprintf(stderr, "%-30s %8.3fs %8.3fs %8.3fs\n", "total", elapsed(&first, &last), user, sys);
+}
@@ -0,0 +1,39 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// The resources one stage of a command line used, from wait4() or, for a builtin run in
+// the shell itself, from getrusage() on the shell's thread
+typedef struct StageUsage {
+    char* command;
+    pid_t pid;              // -1 for a builtin run in the shell
+    int status;             // -1 if it never ran
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+} StageUsage;
+
+// The stages of the last foreground command line
+typedef struct LineUsage {
+    StageUsage* stages;
+    int stages_num;
+    int capacity;
+    int precise;            // reap stages as they exit, so each one's wall time is exact
+} LineUsage;
+
+extern LineUsage line_usage;
+
+void usage_begin(int stages, int precise);
+void usage_spawned(int stage, const char* command, pid_t pid);
+void usage_reaped(int stage, int status, const struct rusage* usage);
+void usage_builtin_begin(int stage, const char* command);
+void usage_builtin_end(int stage, int status);
+void usage_wait(pid_t* pids, int stages);
+
+double usage_seconds(const struct timeval* time);
+void usage_print();
+
+#endif
@@ -0,0 +1,632 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "utilities.h"
+
+// ==================================== echo & printf ====================================
+
+static int print_escape(const char* str, int* consumed, int octal_needs_zero) {
+    /*
+     * Prints the character a backslash escape stands for
+     *
+     * Arguments:
+     *  str: Points right after the backslash
+     *  consumed: Gets the number of characters of str that made up the escape
+     *  octal_needs_zero: Whether octal escapes are written \0NNN (echo, %b) or \NNN (printf formats)
+     *
+     * Returns: 1 if the escape was \c, which stops all further output, 0 otherwise
+     */
+
+    int value = 0;
+    int i = 0;
+
+    *consumed = 1;
+
+    switch (str[0]) {
+        case 'a':  putchar('\a'); return 0;
+        case 'b':  putchar('\b'); return 0;
+        case 'c':  return 1;
+        case 'e':  putchar('\033'); return 0;
+        case 'f':  putchar('\f'); return 0;
+        case 'n':  putchar('\n'); return 0;
+        case 'r':  putchar('\r'); return 0;
+        case 't':  putchar('\t'); return 0;
+        case 'v':  putchar('\v'); return 0;
+        case '\\': putchar('\\'); return 0;
+        case 'x':
+            for (i = 1; i <= 2 && strchr("0123456789abcdefABCDEF", str[i]) && str[i]; i++)
+                value = value * 16 + (str[i] <= '9' ? str[i] - '0' : (str[i] | 0x20) - 'a' + 10);
+
+            if (i == 1) {
+                putchar('\\');
+                return 0;
+            }
+
+            putchar(value);
+            *consumed = i;
+            return 0;
+        case '\0':
+            putchar('\\');
+            *consumed = 0;
+            return 0;
+    }
+
+    if (str[0] >= '0' && str[0] <= '7') {
+        int start = (octal_needs_zero && str[0] == '0') ? 1 : 0;
+
+        if (!octal_needs_zero || str[0] == '0') {
+            for (i = start; i < start + 3 && str[i] >= '0' && str[i] <= '7'; i++)
+                value = value * 8 + (str[i] - '0');
+
+            putchar(value);
+            *consumed = i;
+            return 0;
+        }
+    }
+
+    // Not an escape, keep it as is
+    putchar('\\');
+    putchar(str[0]);
+    return 0;
+}
+
+static int print_escaped(const char* str, int octal_needs_zero) {
+    /*
+     * Prints a string, interpreting its backslash escapes
+     *
+     * Returns: 1 if output was stopped by \c, 0 otherwise
+     */
+
+    for (int i = 0; str[i] != '\0'; i++) {
+        if (str[i] != '\\') {
+            putchar(str[i]);
+            continue;
+        }
+
+        int consumed;
+        if (print_escape(&str[i + 1], &consumed, octal_needs_zero))
+            return 1;
+
+        i += consumed;
+    }
+
+    return 0;
+}
+
+int builtin_echo(int argc, char** argv) {
+    int newline = 1;
+    int escapes = 0;
+    int i = 1;
+
+    // Options are only recognized if every character is one of n, e and E
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1))
+            break;
+
+        for (char* c = argv[i] + 1; *c; c++) {
+            if (*c == 'n')
+                newline = 0;
+            else if (*c == 'e')
+                escapes = 1;
+            else
+                escapes = 0;
+        }
+    }
+
+    for (int first = i; i < argc; i++) {
+        if (i != first)
+            putchar(' ');
+
+        if (!escapes)
+            fputs(argv[i], stdout);
+        else if (print_escaped(argv[i], 1))
+            return 0;
+    }
+
+    if (newline)
+        putchar('\n');
+
+    return 0;
+}
+
+static int numeric_argument(const char* arg, long long* value) {
+    /*
+     * Converts a printf argument to a number. A leading quote gives the value of the next character
+     *
+     * Returns: 1 on success, 0 after printing an error otherwise (value is still set)
+     */
+
+    if (arg[0] == '\'' || arg[0] == '"') {
+        *value = (unsigned char) arg[1];
+        return 1;
+    }
+
+    char* end;
+    errno = 0;
+    *value = strtoll(arg, &end, 0);
+
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return 0;
+    }
+
+    return 1;
+}
+
+int builtin_printf(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char* format = argv[1];
+    int arg = 2;
+    int status = 0;
+
+    // The format is reused for as long as arguments are left, and always used at least once
+    do {
+        int used_argument = 0;
+
+        for (int i = 0; format[i] != '\0'; i++) {
+            if (format[i] == '\\') {
+                int consumed;
+                if (print_escape(&format[i + 1], &consumed, 0))
+                    return status;
+
+                i += consumed;
+                continue;
+            }
+
+            if (format[i] != '%') {
+                putchar(format[i]);
+                continue;
+            }
+
+            if (format[i + 1] == '%') {
+                putchar('%');
+                i++;
+                continue;
+            }
+
+            // Copy the conversion specification, flags, width and precision included
+            char spec[64];
+            int len = 0;
+            spec[len++] = '%';
+            i++;
+
+            while (format[i] != '\0' && strchr("-+ #0123456789.", format[i]) && len < 48)
+                spec[len++] = format[i++];
+
+            char conversion = format[i];
+            const char* value = (arg < argc) ? argv[arg] : NULL;
+
+            if (conversion == '\0') {
+                fprintf(stderr, "printf: missing format character\n");
+                return 1;
+            }
+
+            if (value != NULL) {
+                arg++;
+                used_argument = 1;
+            }
+
+            switch (conversion) {
+                case 's':
+                    spec[len++] = 's';
+                    spec[len] = '\0';
+                    printf(spec, value ? value : "");
+                    break;
+                case 'b':
+                    if (value != NULL && print_escaped(value, 1))
+                        return status;
+                    break;
+                case 'c':
+                    if (value != NULL && value[0] != '\0')
+                        putchar(value[0]);
+                    break;
+                case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': {
+                    long long number = 0;
+                    if (value != NULL && !numeric_argument(value, &number))
+                        status = 1;
+
+                    spec[len++] = 'l';
+                    spec[len++] = 'l';
+                    spec[len++] = conversion;
+                    spec[len] = '\0';
+                    printf(spec, number);
+                    break;
+                }
+                case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': {
+                    double number = 0;
+                    if (value != NULL) {
+                        char* end;
+                        number = strtod(value, &end);
+
+                        if (end == value || *end != '\0') {
+                            fprintf(stderr, "printf: %s: invalid number\n", value);
+                            status = 1;
+                        }
+                    }
+
+                    spec[len++] = conversion;
+                    spec[len] = '\0';
+                    printf(spec, number);
+                    break;
+                }
+                default:
+                    fprintf(stderr, "printf: %%%c: invalid directive\n", conversion);
+                    return 1;
+            }
+        }
+
+        // A format without conversions can't consume the remaining arguments
+        if (!used_argument)
+            break;
+    } while (arg < argc);
+
+    return status;
+}
+
+// ==================================== test ====================================
+
+typedef struct TestParser {
+    char** args;
+    int pos;
+    int end;
+    int error;
+} TestParser;
+
+static int test_or(TestParser* parser);
+
+static int is_binary_operator(const char* op) {
+    const char* ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+
+    for (int i = 0; ops[i] != NULL; i++) {
+        if (strcmp(op, ops[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int is_unary_operator(const char* op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghkLnprsStuwxzGO", op[1]) != NULL;
+}
+
+static long long test_integer(TestParser* parser, const char* arg) {
+    char* end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 10);
+
+    while (*end == ' ' || *end == '\t')
+        end++;
+
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "test: %s: integer expression expected\n", arg);
+        parser->error = 1;
+    }
+
+    return value;
+}
+
+static int test_unary(const char* op, const char* arg) {
+    struct stat st;
+
+    switch (op[1]) {
+        case 'z': return arg[0] == '\0';
+        case 'n': return arg[0] != '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if (stat(arg, &st) != 0)
+        return 0;
+
+    switch (op[1]) {
+        case 'e': return 1;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'g': return (st.st_mode & S_ISGID) != 0;
+        case 'u': return (st.st_mode & S_ISUID) != 0;
+        case 'k': return (st.st_mode & S_ISVTX) != 0;
+        case 'O': return st.st_uid == geteuid();
+        case 'G': return st.st_gid == getegid();
+    }
+
+    return 0;
+}
+
+static int test_binary(TestParser* parser, const char* left, const char* op, const char* right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+    if (strcmp(op, "<") == 0)
+        return strcmp(left, right) < 0;
+    if (strcmp(op, ">") == 0)
+        return strcmp(left, right) > 0;
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat a, b;
+        int has_a = stat(left, &a) == 0;
+        int has_b = stat(right, &b) == 0;
+
+        if (op[1] == 'e')
+            return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+
+        if (!has_a || !has_b)
+            return (op[1] == 'n') ? has_a : has_b;
+
+        long long diff = (a.st_mtim.tv_sec - b.st_mtim.tv_sec) * 1000000000LL + (a.st_mtim.tv_nsec - b.st_mtim.tv_nsec);
+        return (op[1] == 'n') ? diff > 0 : diff < 0;
+    }
+
+    long long l = test_integer(parser, left);
+    long long r = test_integer(parser, right);
+
+    if (strcmp(op, "-eq") == 0) return l == r;
+    if (strcmp(op, "-ne") == 0) return l != r;
+    if (strcmp(op, "-lt") == 0) return l < r;
+    if (strcmp(op, "-le") == 0) return l <= r;
+    if (strcmp(op, "-gt") == 0) return l > r;
+    return l >= r;
+}
+
+static int test_primary(TestParser* parser) {
+    char** args = parser->args;
+    int remaining = parser->end - parser->pos;
+
+    if (remaining <= 0) {
+        fprintf(stderr, "test: argument expected\n");
+        parser->error = 1;
+        return 0;
+    }
+
+    char* arg = args[parser->pos];
+
+    // A binary operator after the first word takes precedence, so that "test -n = -n" compares strings
+    if (remaining >= 3 && is_binary_operator(args[parser->pos + 1])) {
+        parser->pos += 3;
+        return test_binary(parser, arg, args[parser->pos - 2], args[parser->pos - 1]);
+    }
+
+    if (strcmp(arg, "!") == 0) {
+        parser->pos++;
+        return !test_primary(parser);
+    }
+
+    if (strcmp(arg, "(") == 0 && remaining >= 2) {
+        parser->pos++;
+        int result = test_or(parser);
+
+        if (parser->pos >= parser->end || strcmp(args[parser->pos], ")") != 0) {
+            fprintf(stderr, "test: ')' expected\n");
+            parser->error = 1;
+            return 0;
+        }
+
+        parser->pos++;
+        return result;
+    }
+
+    if (remaining >= 2 && is_unary_operator(arg)) {
+        parser->pos += 2;
+        return test_unary(arg, args[parser->pos - 1]);
+    }
+
+    // A lone word is true when it's not empty
+    parser->pos++;
+    return arg[0] != '\0';
+}
+
+static int test_and(TestParser* parser) {
+    int result = test_primary(parser);
+
+    while (parser->pos < parser->end && strcmp(parser->args[parser->pos], "-a") == 0) {
+        parser->pos++;
+        result = test_primary(parser) && result;
+    }
+
+    return result;
+}
+
+static int test_or(TestParser* parser) {
+    int result = test_and(parser);
+
+    while (parser->pos < parser->end && strcmp(parser->args[parser->pos], "-o") == 0) {
+        parser->pos++;
+        result = test_and(parser) || result;
+    }
+
+    return result;
+}
+
+int builtin_test(int argc, char** argv) {
+    /*
+     * test and [ evaluate their arguments as a conditional expression
+     *
+     * Returns: 0 if the expression is true, 1 if it's false, 2 on errors
+     */
+
+    TestParser parser = { argv, 1, argc, 0 };
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+
+        parser.end--;
+    }
+
+    if (parser.end == 1)
+        return 1;
+
+    int result = test_or(&parser);
+
+    if (!parser.error && parser.pos != parser.end) {
+        fprintf(stderr, "test: %s: unexpected argument\n", argv[parser.pos]);
+        parser.error = 1;
+    }
+
+    if (parser.error)
+        return 2;
+
+    return !result;
+}
+
+int builtin_true(int argc, char** argv) {
+    return 0;
+}
+
+int builtin_false(int argc, char** argv) {
+    return 1;
+}
+
+// ==================================== cat ====================================
+
+static int copy_read_write(int in_fd, int out_fd) {
+    static char* buffer = NULL;
+
+    if (buffer == NULL)
+        buffer = malloc(COPY_CHUNK_SIZE);
+
+    while (1) {
+        ssize_t n = read(in_fd, buffer, COPY_CHUNK_SIZE);
+
+        if (n == 0)
+            return 0;
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = write(out_fd, buffer + written, n - written);
+
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+
+            written += w;
+        }
+    }
+}
+
+int copy_fd(int in_fd, int out_fd) {
+    /*
+     * Copies everything from one descriptor to another, keeping the data in the kernel when possible:
+     * copy_file_range between regular files, splice when either side is a pipe, sendfile from a
+     * regular file to anything else, and a read/write loop when none of those apply
+     *
+     * Returns: 0 on success, -1 with errno set otherwise
+     */
+
+    struct stat in_st, out_st;
+
+    if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1)
+        return -1;
+
+    ssize_t n;
+    int copied = 0;     // once data moved, falling back would be fine but isn't needed
+
+    if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode)) {
+        while ((n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK_SIZE, 0)) > 0)
+            copied = 1;
+
+        if (n == 0)
+            return 0;
+
+        // Different filesystems, an O_APPEND output, or no support in this kernel
+        if (copied || (errno != EXDEV && errno != EINVAL && errno != EBADF && errno != ENOSYS && errno != EOPNOTSUPP))
+            return -1;
+    }
+
+    if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) {
+        while ((n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+            copied = 1;
+
+        if (n == 0)
+            return 0;
+
+        if (copied || errno != EINVAL)
+            return -1;
+    }
+
+    if (S_ISREG(in_st.st_mode)) {
+        while ((n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK_SIZE)) > 0)
+            copied = 1;
+
+        if (n == 0)
+            return 0;
+
+        if (copied || (errno != EINVAL && errno != ENOSYS))
+            return -1;
+    }
+
+    return copy_read_write(in_fd, out_fd);
+}
+
+int builtin_cat(int argc, char** argv) {
+    int status = 0;
+    int files = 0;
+
+    fflush(stdout);
+
+    for (int i = 1; i < argc; i++) {
+        // -u (unbuffered) is what we do anyway
+        if (strcmp(argv[i], "-u") == 0)
+            continue;
+
+        files++;
+
+        int fd = STDIN_FILENO;
+
+        if (strcmp(argv[i], "-") != 0) {
+            fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+
+            if (fd == -1) {
+                fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+                status = 1;
+                continue;
+            }
+        }
+
+        if (copy_fd(fd, STDOUT_FILENO) == -1) {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+        }
+
+        if (fd != STDIN_FILENO)
+            close(fd);
+    }
+
+    if (files == 0 && copy_fd(STDIN_FILENO, STDOUT_FILENO) == -1) {
+        fprintf(stderr, "cat: -: %s\n", strerror(errno));
+        status = 1;
+    }
+
+    return status;
+}
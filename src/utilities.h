@@ -0,0 +1,15 @@
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
+#define COPY_CHUNK_SIZE (1 << 20)
+
+int builtin_echo(int argc, char** argv);
+int builtin_printf(int argc, char** argv);
+int builtin_test(int argc, char** argv);
+int builtin_true(int argc, char** argv);
+int builtin_false(int argc, char** argv);
+int builtin_cat(int argc, char** argv);
+
+int copy_fd(int in_fd, int out_fd);
+
+#endif